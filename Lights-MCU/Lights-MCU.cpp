@@ -17,6 +17,18 @@
 #include <string>
 
 #include "include/parsing.h"
+#include "playback.h"
+#include "comms.h"
+#include "uart_rx.h"
+#include "frame_queue.h"
+#include "frame_buffer.h"
+#include "led_sequence.h"
+#include "parallel_output.h"
+#include "output_stage.h"
+#include "effects.h"
+#include "storage.h"
+#include "flash_store.h"
+#include "arena.h"
 
 #include "blink.pio.h"
 #include "WS2811.pio.h"
@@ -29,58 +41,44 @@
 
 
 
-static mutex_t uart_mutex;
-
 volatile uint8_t recv_char;
 
 
 volatile uint32_t current_time;
-volatile uint32_t time_last_byte_recvd;
-
-volatile Animation_Config light_config = {250,100,2,0,0,0,1,0,1,0};
-
-uint32_t next_frame[max_led_len] = {0};
-uint32_t current_frame[max_led_len] = {0};
-volatile uint8_t current_file = 0;
-volatile uint32_t playback_location = 0;
-
-volatile File files[10];
-volatile uint32_t data[max_data_len] = {0};
 
-
-volatile uint32_t led_frame[max_frame_len][max_led_len] = {0};
-volatile uint32_t working_frame_index = 0;
 volatile int dma_chan;
-
-char uart_buff[250];
-char status_buff[500];
-JsonDocument status;
+// feeds ws2811_parallel when light_config.strip_count is more than 1
+volatile int parallel_dma_chan;
+static Pio_SM_info parallel_pio;
+static pio_sm_config parallel_config;
+// pins ws2811_parallel drives from WS2811_PIN, only the single string's until there is more than one strip
+static uint8_t parallel_pins = 1;
+
+// UART RX DMA, rx_dma_chan fills UartRx::ring and rx_ctrl_chan reloads its count when it runs out
+constexpr uint32_t rx_dma_transfer_count = 0x40000000;
+static const uint32_t rx_dma_reload = rx_dma_transfer_count;
+static int rx_dma_chan;
+static int rx_ctrl_chan;
+static uint32_t rx_dma_last_remaining = rx_dma_transfer_count;
+
+// chained LED DMA for pre-rendered led_frame sequences, see led_sequence.h.
+// led_seq_ctrl_chan feeds LedSequence::blocks into led_seq_chan, led_seq_timer paces the gaps
+static int led_seq_chan;
+static int led_seq_ctrl_chan;
+static int led_seq_timer;
+static uint32_t led_seq_frame_ctrl;
+static uint32_t led_seq_gap_ctrl;
+static volatile void* led_seq_fifo;
+
+// the whole report in one go, about 60 fields pretty printed
+constexpr size_t status_buff_len = 2048;
+char status_buff[status_buff_len];
 uint16_t debug_working_index = 0;
 
 NRF_HAL spi_hal;
 NRF24 wireless;
 
 
-void output_byte(uint8_t b) {
-    // uart_putc_raw(uart0, b);  // hardware UART Only
-    putchar_raw(b);           // Both UART AND USB
-}
-
-void uart_out(char* buffer, int buffer_len){
-    mutex_enter_blocking(&uart_mutex);
-    for(int i=0; i< buffer_len; i++){
-        if (buffer[i] == 0){ // NULL ending
-            mutex_exit(&uart_mutex);
-            return;
-        }
-        output_byte(buffer[i]);
-    }
-    // output_byte(0); // NULL ending
-    mutex_exit(&uart_mutex);
-}
-
-
-
 
 void core1_entry(void){
     mutex_enter_blocking(&uart_mutex);
@@ -109,60 +107,16 @@ void core1_entry(void){
             Parsing::uart_parsing_state = ParseState::WAIT_START;
         }
         
-        if (Parsing::uart_parsing_state == ParseState::WAIT_FOR_PROCESSING){
-            if(light_config.debug_cmd){
-                sprintf(uart_buff, "VER: %02x, CMD: %02x, LEN: %02x, PLD: [", 
-                        Parsing::uart_buffer[0], // ver
-                        Parsing::uart_buffer[1], // cmd
-                        Parsing::uart_buffer[2] // len
-                    );
-
-                for (int i = 0;i<Parsing::payload_len; i++){
-                    sprintf(uart_buff, "%s %2X", 
-                        uart_buff,
-                        Parsing::uart_buffer[3+i]
-                    );
-                }
-                sprintf(uart_buff, "%s] \n", 
-                    uart_buff
-                );
-                mutex_enter_blocking(&uart_mutex);
-                uart_puts(UART_ID, uart_buff);
-                mutex_exit(&uart_mutex);
-            }
-            
-            uint32_t timing = time_us_32();
-            result.clear();
-            status["Timing"]["result_clear"] = time_us_32()-timing;
-            // Total processing time for a FILE::GET is about 155 us
-            timing = time_us_32();
-            parse_payload(result, Parsing::uart_buffer, Parsing::payload_len);
-            
-            status["Timing"]["e2e"] = time_us_32()-time_last_byte_recvd;
-            status["Timing"]["parse"] = time_us_32()-timing;
-            
-            // format the results for sending back
-            // sprintf(uart_buff, "Value: %08X, Error: %02X \n", result.value, result.error);
-            
-            auto length = serializeJson(result, uart_buff);
-            uart_buff[length] = '\n';
-
-            uart_out(uart_buff, 250);
-            clear_uart_buffer(uart_buff, 250);
-            // uart_out(['\n'], 255);
-            
-            // mutex_enter_blocking(&uart_mutex);
-            // uart_puts(UART_ID, uart_buff);
-            // uart_putc(UART_ID, '\n');
-            // mutex_exit(&uart_mutex);
-
-            // mutex_enter_blocking(&uart_mutex);
-            
-            // mutex_exit(&uart_mutex);
-
-            
-            Parsing::uart_parsing_state = ParseState::WAIT_START; // finished processing, put it back to waiting for the next command
-
+        // work through everything the parser on core 0 has queued up
+        handle_pending_command(result);
+        // anything those changed is saved once they stop coming
+        flash_store_poll();
+        // one block at a time closing up the holes freed files left, never in the middle of a frame
+        arena_compact_step();
+
+        // get the next frame ready for the frame timer to swap in, paused while not running
+        if (light_config.running){
+            render_pending_frame();
         }
         
     }
@@ -178,6 +132,60 @@ void on_uart_rx() {
     }
 }
 
+void setup_uart_rx_dma(){
+    // The data channel copies every received byte into the ring. The write address wraps on the ring size
+    // so it never needs to be reset, and when its count runs out the control channel writes it back
+    // through the count trigger register, so the CPU never has to touch it.
+    rx_dma_chan = dma_claim_unused_channel(true);
+    rx_ctrl_chan = dma_claim_unused_channel(true);
+
+    dma_channel_config rx_config = dma_channel_get_default_config(rx_dma_chan);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, true);
+    channel_config_set_ring(&rx_config, true, uart_rx_ring_bits);
+    channel_config_set_dreq(&rx_config, uart_get_dreq(UART_ID, false));
+    channel_config_set_chain_to(&rx_config, rx_ctrl_chan);
+
+    dma_channel_config ctrl_config = dma_channel_get_default_config(rx_ctrl_chan);
+    channel_config_set_transfer_data_size(&ctrl_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_config, false);
+    channel_config_set_write_increment(&ctrl_config, false);
+
+    dma_channel_configure(
+                rx_ctrl_chan,
+                &ctrl_config,
+                &dma_hw->ch[rx_dma_chan].al1_transfer_count_trig,
+                &rx_dma_reload,
+                1,
+                false
+            );
+
+    dma_channel_configure(
+                rx_dma_chan,
+                &rx_config,
+                UartRx::ring,
+                &uart_get_hw(UART_ID)->dr,
+                rx_dma_transfer_count,
+                true
+            );
+}
+
+uint32_t rx_dma_bytes_written(){
+    // how far the count has dropped since the last call is how many bytes landed in the ring
+    uint32_t remaining = dma_channel_hw_addr(rx_dma_chan)->transfer_count;
+    uint32_t written;
+    if (remaining <= rx_dma_last_remaining){
+        written = rx_dma_last_remaining - remaining;
+    }
+    else{
+        // the control channel reloaded the count in between
+        written = rx_dma_last_remaining + (rx_dma_transfer_count - remaining);
+    }
+    rx_dma_last_remaining = remaining;
+    return written;
+}
+
 void setup_uart(){
     // Set up our UART
     uart_init(UART_ID, BAUD_RATE);
@@ -190,6 +198,8 @@ void setup_uart(){
 
     uart_set_hw_flow(UART_ID, false, false);
 
+    setup_uart_rx_dma();
+
     /* Disabling the interrupts in favor of polling for now, to get the USB working. 
     // Set up a RX interrupt
     // We need to set up the handler first
@@ -251,7 +261,7 @@ Pio_SM_info setup_Blinky_Pio(){
 
 Pio_SM_info setup_WS2811_Pio(){
     // PIO Blinking example
-    constexpr uint data_output_pin = 13;
+    constexpr uint data_output_pin = WS2811_PIN;
     gpio_set_dir(data_output_pin, true);
     // gpio_set_function(data_output_pin, GPIO_FUNC_PIO1);
     PIO pio = pio1;
@@ -265,10 +275,120 @@ Pio_SM_info setup_WS2811_Pio(){
     return {pio, sm, offset};
 }
 
-uint32_t rgb_to_int(uint8_t red, uint8_t green, uint8_t blue){
-    // format is GRB
-    uint32_t rgb = (red << 16)|(green<<8) | blue;
-    return rgb;
+void start_led_sequence(){
+    if (light_config.frame_count == 0){
+        // only the null block, the end IRQ would just keep restarting it
+        LedSequence::running = false;
+        return;
+    }
+    build_led_sequence(led_seq_frame_ctrl, led_seq_gap_ctrl, led_seq_fifo,
+                       light_config.frame_count, light_config.led_count, light_config.fps_ms);
+    LedSequence::running = true;
+    dma_channel_set_read_addr(led_seq_ctrl_chan, LedSequence::blocks, true);
+}
+
+void stop_led_sequence(){
+    LedSequence::running = false;
+    dma_channel_abort(led_seq_ctrl_chan);
+    dma_channel_abort(led_seq_chan);
+}
+
+// the null block at the end of the list, the only time the CPU hears from the sequence
+void on_led_sequence_end(){
+    dma_channel_acknowledge_irq1(led_seq_chan);
+    if (led_sequence_end()){
+        // rebuilt every time round so frame_count, led_count and fps_ms changes are picked up
+        start_led_sequence();
+    }
+}
+
+void setup_led_sequence_dma(Pio_SM_info ws2811_pio){
+    led_seq_chan = dma_claim_unused_channel(true);
+    led_seq_ctrl_chan = dma_claim_unused_channel(true);
+    led_seq_timer = dma_claim_unused_timer(true);
+    led_seq_fifo = &ws2811_pio.pio->txf[ws2811_pio.sm];
+
+    // one gap transfer every sequence_gap_tick_us
+    dma_timer_set_fraction(led_seq_timer, 1, clock_get_hz(clk_sys) / (1000000 / sequence_gap_tick_us));
+
+    dma_channel_config frame_config = dma_channel_get_default_config(led_seq_chan);
+    channel_config_set_transfer_data_size(&frame_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&frame_config, true);
+    channel_config_set_write_increment(&frame_config, false);
+    channel_config_set_dreq(&frame_config, pio_get_dreq(ws2811_pio.pio, ws2811_pio.sm, true));
+    channel_config_set_chain_to(&frame_config, led_seq_ctrl_chan);
+    // no IRQ per block, only when the null block is reached
+    channel_config_set_irq_quiet(&frame_config, true);
+    led_seq_frame_ctrl = channel_config_get_ctrl_value(&frame_config);
+
+    dma_channel_config gap_config = frame_config;
+    channel_config_set_read_increment(&gap_config, false);
+    channel_config_set_dreq(&gap_config, dma_get_timer_dreq(led_seq_timer));
+    led_seq_gap_ctrl = channel_config_get_ctrl_value(&gap_config);
+
+    // The control channel copies a whole block into the alias 1 ctrl, read_addr, write_addr and transfer_count_trig.
+    // The write wraps on 16 bytes so every block lands on the same four registers, and the count
+    // reloads each time the LED channel chains back to it
+    dma_channel_config ctrl_config = dma_channel_get_default_config(led_seq_ctrl_chan);
+    channel_config_set_transfer_data_size(&ctrl_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_config, true);
+    channel_config_set_write_increment(&ctrl_config, true);
+    channel_config_set_ring(&ctrl_config, true, 4);
+
+    dma_channel_configure(
+                led_seq_ctrl_chan,
+                &ctrl_config,
+                &dma_hw->ch[led_seq_chan].al1_ctrl,
+                LedSequence::blocks,
+                sizeof(DmaControlBlock) / sizeof(uint32_t),
+                false
+            );
+
+    dma_channel_set_irq1_enabled(led_seq_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, on_led_sequence_end);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+Pio_SM_info setup_WS2811_parallel_Pio(){
+    // shares pio1 and WS2811_PIN with the single string, only one of them is fed at a time.
+    // the pins after it are taken by set_parallel_pins once strip_count goes over 1
+    PIO pio = pio1;
+    uint offset = pio_add_program(pio, &ws2811_parallel_program);
+    uint sm = pio_claim_unused_sm(pio, true);
+    parallel_config = ws2811_parallel_program_init(pio, sm, offset, WS2811_PIN, 1);
+    parallel_pins = 1;
+
+    pio_sm_set_enabled(pio, sm, true);
+
+    parallel_pio = {pio, sm, offset};
+    return parallel_pio;
+}
+
+// drive one pin per strip, as many as this board has (WS2811_PARALLEL_PINS). only called between frames,
+// with the SM stalled on an empty FIFO
+static void set_parallel_pins(uint8_t strip_count){
+    uint8_t pins = strip_count < WS2811_PARALLEL_PINS ? strip_count : WS2811_PARALLEL_PINS;
+    if (pins < 1){
+        pins = 1;
+    }
+    if (pins == parallel_pins){
+        return;
+    }
+    PIO pio = parallel_pio.pio;
+    uint sm = parallel_pio.sm;
+    pio_sm_set_enabled(pio, sm, false);
+    for (uint pin = WS2811_PIN + parallel_pins; pin < WS2811_PIN + pins; pin++){
+        pio_gpio_init(pio, pin);
+    }
+    // the ones it no longer drives go back to plain inputs
+    for (uint pin = WS2811_PIN + pins; pin < WS2811_PIN + parallel_pins; pin++){
+        gpio_init(pin);
+    }
+    pio_sm_set_consecutive_pindirs(pio, sm, WS2811_PIN, pins, true);
+    sm_config_set_out_pins(&parallel_config, WS2811_PIN, pins);
+    pio_sm_init(pio, sm, parallel_pio.offset, &parallel_config);
+    pio_sm_set_enabled(pio, sm, true);
+    parallel_pins = pins;
 }
 
 bool system_status_report(__unused repeating_timer_t *rt){
@@ -282,29 +402,94 @@ bool system_status_report(__unused repeating_timer_t *rt){
 
         status["Status"]["playback_location"] = playback_location;
         status["Status"]["Current_File"] = current_file;
-        status["Status"]["current_file_start"] = files[current_file].start;
-        status["Status"]["current_file_end"] = files[current_file].end;
+        status["Status"]["current_file_start"] = files.start[current_file];
+        status["Status"]["current_file_end"] = files.end[current_file];
+        status["Status"]["current_file_format"] = (uint8_t) files.format[current_file];
+        status["Status"]["current_file_storage"] = (uint8_t) files.storage[current_file];
+        status["Status"]["files_in_use"] = file_table_count();
 
         status["Config"]["fps"] =light_config.fps_ms;
         status["Config"]["running"] =light_config.running;
         status["Config"]["led_count"] =light_config.led_count;
         status["Config"]["frame_count"] =light_config.frame_count;
         status["Config"]["debug_cmd"] =light_config.debug_cmd;
+        status["Config"]["binary_reply"] =light_config.binary_reply;
+        status["Config"]["strip_count"] =light_config.strip_count;
+        status["Config"]["brightness"] =light_config.brightness;
+        status["Config"]["channel_gain"] =light_config.channel_gain;
+        status["Config"]["color_order"] =light_config.color_order;
+        status["Config"]["gamma"] =light_config.gamma;
+        status["Config"]["dither"] =light_config.dither;
+        status["Config"]["refreshes_per_frame"] =light_config.refreshes_per_frame;
+
+        status["UART"]["rx_bytes"] = UartRx::bytes_received;
+        status["UART"]["rx_high_water"] = UartRx::high_water;
+        status["UART"]["rx_overruns"] = UartRx::overrun_count;
+        status["UART"]["rx_overrun_bytes"] = UartRx::overrun_bytes;
+        // the hardware FIFO overflowing before the DMA got to it
+        status["UART"]["fifo_overrun"] = (bool) (uart_get_hw(UART_ID)->rsr & UART_UARTRSR_OE_BITS);
+        uart_get_hw(UART_ID)->rsr = 0; // any write clears the error flags
+
+        status["Queue"]["waiting"] = frame_queue_count();
+        status["Queue"]["high_water"] = FrameQueue::high_water;
+        status["Queue"]["dropped"] = FrameQueue::dropped;
+
+        status["Frame"]["repeated"] = FrameBuffer::repeated;
+        status["Frame"]["render_us"] = FrameBuffer::render_us;
+        status["Frame"]["sequence_loops"] = LedSequence::loops;
+        uint32_t sequence_ms = 0;
+        for (uint16_t frame = 0; frame < light_config.frame_count and frame < max_frame_len; frame++){
+            sequence_ms += sequence_frame_ms(frame, light_config.fps_ms);
+        }
+        status["Frame"]["sequence_ms"] = sequence_ms;
+        status["Frame"]["dither_us"] = OutputStage::dither_us;
+
+        for (uint8_t i = 0; i < effect_count; i++){
+            status["Effects"][effect_registry[i].name] = Effects::render_us[i];
+        }
+
+        status["Flash"]["head"] = FlashStore::head;
+        status["Flash"]["checkpoint"] = FlashStore::checkpoint;
+        status["Flash"]["pages_written"] = FlashStore::pages_written;
+        status["Flash"]["sectors_erased"] = FlashStore::sectors_erased;
+        status["Flash"]["load_us"] = FlashStore::load_us;
+        status["Flash"]["poll_us"] = FlashStore::poll_us;
+
+        status["Arena"]["free_words"] = Arena::free_words;
+        status["Arena"]["largest_free"] = Arena::largest_free;
+        status["Arena"]["moves"] = Arena::moves;
+        status["Arena"]["words_moved"] = Arena::words_moved;
+
+        status["Prefetch"]["hits"] = Prefetch::hits;
+        status["Prefetch"]["misses"] = Prefetch::misses;
+
+        status["Stream"]["active"] = Stream::active;
+        status["Stream"]["expected_seq"] = Stream::expected_seq;
+        status["Stream"]["written"] = Stream::cursor - Stream::start;
 
         // status["Wireless"]["Power"] =wireless.status.PWR_UP;
         // status["Wireless"]["RX Mode"] =wireless.status.PRIM_RX;
         // status["Wireless"]["Revc Pwr Dector"] =recv_power_dector.RPD;
 
         // clear_uart_buffer(buffer, 500);
-        clear_uart_buffer(status_buff, 500);
-        auto length = serializeJsonPretty(status, status_buff);
+        // room for the newline and the terminator after it, compact if pretty won't fit, a cut off report is no use to anyone
+        size_t length = 0;
+        if (measureJsonPretty(status) + 2 <= status_buff_len){
+            length = serializeJsonPretty(status, status_buff, status_buff_len);
+        }
+        else if (measureJson(status) + 2 <= status_buff_len){
+            length = serializeJson(status, status_buff, status_buff_len);
+        }
         status_buff[length] = '\n';
+        status_buff[length + 1] = '\0';
 
         // uart_out(status_buff, 500);
 
-        mutex_enter_blocking(&uart_mutex);
-        uart_puts(UART_ID, status_buff); // only put on hardware UART
-        mutex_exit(&uart_mutex);
+        // this is a timer IRQ, it can't wait on a reply that is half way out. skip this one, there's another in 2 seconds
+        if (length != 0 and mutex_try_enter(&uart_mutex, nullptr)){
+            uart_puts(UART_ID, status_buff); // only put on hardware UART
+            mutex_exit(&uart_mutex);
+        }
         status.remove("Debug");
         debug_working_index = 0;
         status.remove("Timing");
@@ -315,96 +500,54 @@ bool system_status_report(__unused repeating_timer_t *rt){
 
 
 bool push_data_to_lights_callback(__unused repeating_timer_t *rt){
-    working_frame_index = (working_frame_index+1) % light_config.frame_count;
+    if (light_config.frame_count != 0){
+        working_frame_index = (working_frame_index+1) % light_config.frame_count;
+    }
     
     rt->delay_us = ((int64_t) light_config.fps_ms)*-1000;
+    // refresh faster than the content under TEMPORAL dither, core 1 only renders new content every
+    // frame_refreshes. never so fast that a refresh can't get out and latch before the next one
+    rt->delay_us /= frame_refreshes();
 
     // for some reason these didn't work?
     // dma_channel_set_transfer_count(dma_chan, light_config.led_count, false);
     // dma_channel_set_write_addr(dma_chan, &led_frame[working_frame_index][0], true);
 
-
-    if (light_config.running)
-        memcpy(current_frame, next_frame, sizeof(next_frame));
-        // for (int i=0; i<light_config.led_count; i++){
-        //     current_frame[i] = next_frame[i];
-        // }
-        dma_channel_transfer_from_buffer_now(dma_chan,&current_frame, (uint32_t) light_config.led_count);
-        // set up the next frame for the next loop. The DMA is happening in the background so we dont have to worry about timeing
-        volatile int i = 0;
-        volatile int j = 0;
-        volatile int temp_index = 0;
-        volatile uint8_t count = 0;
-
-        // data is a continous section of memory for all of the light colors in RLE form
-        // current file is just the index of the current file that we are playing back
-        // we need to read data from the last place we were and keep reading until we have hit the config.led_count ammount
-        // playback location is the last position that we read +1, start from this location next time
-        // TODO: right now i is not indexing correctly
-        
-        if (current_file != 0){
-            current_file = current_file %10;
-        }
-        count = data[playback_location] & 0xFF;
-        if (count == 0){
-            count =1;
-        }
-        for (i=0; i<light_config.led_count; i++){
-            --count;
-            next_frame[i] = data[playback_location];
-            if (count == 0){
-                playback_location += 1;
-                count = data[playback_location] &0xFF;
-                if (count == 0){
-                    count =1;
-                }
-
-            }
-            
-            
-            if (playback_location > files[current_file].end){
-                if (files[current_file].action == EndAction::REPEAT){
-                    if (i != (light_config.led_count - 1)){
-                        printf("Something has gone wrong");
-                    }
-                    playback_location = (uint32_t) files[current_file].start;
-                }
-                else if (files[current_file].action == EndAction::RUN_FILE){
-                    // TODO: figure out a way to set this kind of info
-                }
-                
-            }
+    if (light_config.dma_sequence){
+        // the chained DMA plays led_frame on its own, there is nothing to do per frame
+        if (!LedSequence::running){
+            start_led_sequence();
         }
-        // printf("Next ", playback_location);
-        
+        return true;
+    }
+    if (LedSequence::running){
+        stop_led_sequence();
+    }
+
+    // core 1 has already rendered the next frame, all that happens in here is a pointer swap
+    uint32_t* frame = frame_buffer_swap();
+    if (light_config.strip_count > 1){
+        set_parallel_pins(light_config.strip_count);
+        // already transposed on core 1 too
+        uint32_t words = parallel_strip_len(light_config.strip_count) * parallel_words_per_led;
+        dma_channel_transfer_from_buffer_now(parallel_dma_chan, ParallelOutput::wire[FrameBuffer::front], words);
+        return true;
+    }
+    uint16_t led_count = light_config.led_count < max_led_len ? light_config.led_count : max_led_len;
+    dma_channel_transfer_from_buffer_now(dma_chan, frame, (uint32_t) led_count);
        
     return true; // keep repeating
 }
 
-void default_file_0(){
-    // setup a basic static color for file 0
-    uint8_t temp = 0x05;
-    data[0] =  temp+ (rgb_to_int(168, 136, 20) << 8);
-    temp = 95;
-    data[1] =  temp+ (rgb_to_int(100, 100, 100) << 8);
-    files[0].start = 0;
-    files[0].end = 1;
-    files[0].action = EndAction::REPEAT;
-    playback_location = files[0].start;
-
-}
-
 void poll_uarts() {
-    // --- 1. Read from hardware UART ---
-    while (uart_is_readable(uart0)) {
-        uint8_t b = uart_getc(uart0);
+    // --- 1. Drain what the DMA has put in the ring from the hardware UART ---
+    if (drain_rx_ring(rx_dma_bytes_written())) {
         time_last_byte_recvd = time_us_32();
-        process_byte(b);
     }
 
     // --- 2. Read from USB CDC (stdio_usb) ---
     int c;
-    while ((c = getchar_timeout_us(100)) != PICO_ERROR_TIMEOUT) {
+    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
         time_last_byte_recvd = time_us_32();
         // char temp_buff[50];
         // sprintf(temp_buff, "Before: C:%d S:%d\n", c, (uint8_t) Parsing::uart_parsing_state);
@@ -498,7 +641,15 @@ int main()
     mutex_exit(&uart_mutex);
 
 
-   
+    // before core 1 starts playing anything out of it
+    setup_storage();
+
+    // every file id free to start with, then whatever was uploaded before the last power cycle, straight out of flash.
+    // core 1 polls the store and compacts data[] as soon as it is running, so this has to be done first
+    file_table_clear();
+    if (!flash_store_load()){
+        default_file_0();
+    }
     
     multicore_launch_core1(core1_entry);
     sleep_ms(500);
@@ -546,13 +697,35 @@ int main()
                 dma_chan,
                 &dma_config,
                 &ws2811_pio.pio->txf[ws2811_pio.sm],
-                &current_frame,
+                FrameBuffer::buffers[0],
                 (uint32_t) light_config.led_count,
                 false
             );
 
-    
-    default_file_0();
+    setup_led_sequence_dma(ws2811_pio);
+
+    Pio_SM_info ws2811_parallel_pio = setup_WS2811_parallel_Pio();
+    sprintf(uart_buff, "ws2811 parallel sm: %d, offset: %d \n", ws2811_parallel_pio.sm, ws2811_parallel_pio.offset);
+    mutex_enter_blocking(&uart_mutex);
+    uart_puts(UART_ID, uart_buff);
+    mutex_exit(&uart_mutex);
+
+    parallel_dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config parallel_dma_config = dma_channel_get_default_config(parallel_dma_chan);
+    channel_config_set_transfer_data_size(&parallel_dma_config, DMA_SIZE_32);
+    channel_config_set_dreq(&parallel_dma_config, pio_get_dreq(ws2811_parallel_pio.pio, ws2811_parallel_pio.sm, true));
+    channel_config_set_read_increment(&parallel_dma_config, true);
+    channel_config_set_write_increment(&parallel_dma_config, false);
+
+    dma_channel_configure(
+                parallel_dma_chan,
+                &parallel_dma_config,
+                &ws2811_parallel_pio.pio->txf[ws2811_parallel_pio.sm],
+                ParallelOutput::wire[0],
+                0,
+                false
+            );
+
 
     repeating_timer_t timer;
 
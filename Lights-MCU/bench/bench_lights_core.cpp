@@ -0,0 +1,630 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ArduinoJson-v7.4.2.h"
+#include "parsing.h"
+#include "playback.h"
+#include "comms.h"
+#include "crc16.h"
+#include "uart_rx.h"
+#include "frame_queue.h"
+#include "frame_buffer.h"
+#include "parallel_output.h"
+#include "output_stage.h"
+#include "effects.h"
+#include "storage.h"
+#include "flash_store.h"
+#include "arena.h"
+#include "host_shim.h"
+
+// Host numbers for the same stages the firmware reports in status["Timing"]
+
+struct BenchCommand {
+    const char* name;
+    CommandState id;
+    std::vector<uint32_t> words;
+};
+
+// command arguments followed by count single-LED RLE colors
+static std::vector<uint32_t> with_colors(std::vector<uint32_t> words, int count){
+    for (int i = 0; i < count; i++){
+        words.push_back((rgb_to_int(i, 255 - i, 0x40) << 8) | 1);
+    }
+    return words;
+}
+
+static const std::vector<BenchCommand>& bench_commands(){
+    static const std::vector<BenchCommand> commands = {
+        {"NOOP", CommandState::NOOP, {}},
+        {"CONFIG_SET", CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::echo, 0x3456}},
+        {"CONFIG_GET", CommandState::CONFIG_GET, {(uint32_t) ConfigIndex::fps_ms}},
+        {"COLOR_SET", CommandState::COLOR_SET, {0, 10, 0x00FF00}},
+        {"MULTI_COLOR_SET", CommandState::MULTI_COLOR_SET, with_colors({0, 0}, 60)},
+        {"COLOR_GET", CommandState::COLOR_GET, {0, 1}},
+        {"FILE_SET", CommandState::FILE_SET, with_colors({1, 0, 0}, 60)},
+        {"FILE_GET", CommandState::FILE_GET, {0}},
+    };
+    return commands;
+}
+
+// bytes/sec through the frame state machine for a FILE_SET of state.range(0) colors
+static void BM_ProcessByte(benchmark::State& state){
+    HostShim::reset_state();
+    std::vector<uint8_t> frame = HostShim::build_frame(CommandState::FILE_SET, with_colors({1, 0, 0}, state.range(0)));
+
+    for (auto _ : state){
+        for (uint8_t b : frame){
+            process_byte(b);
+        }
+        benchmark::DoNotOptimize(Parsing::uart_parsing_state);
+        frame_queue_pop();
+    }
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_ProcessByte)->Arg(0)->Arg(16)->Arg(60);
+
+// bit at a time reference, what the table in crc16.h replaces
+static uint16_t crc16_bitwise_update(uint16_t crc, uint8_t b){
+    crc ^= b << 8;
+    for (int bit = 0; bit < 8; bit++){
+        crc = (crc & 0x8000) ? (crc << 1) ^ CRC16_POLY : (crc << 1);
+    }
+    return crc;
+}
+
+// cost per byte of keeping the frame CRC up to date, state.range(0) picks bitwise (0) or table (1)
+static void BM_Crc16Update(benchmark::State& state){
+    std::vector<uint8_t> buffer(256);
+    for (size_t i = 0; i < buffer.size(); i++){
+        buffer[i] = i * 7;
+    }
+    const bool table = state.range(0);
+
+    for (auto _ : state){
+        uint16_t crc = CRC16_INIT;
+        for (uint8_t b : buffer){
+            crc = table ? crc16_update(crc, b) : crc16_bitwise_update(crc, b);
+        }
+        benchmark::DoNotOptimize(crc);
+    }
+    state.SetBytesProcessed(state.iterations() * buffer.size());
+    state.counters["time_per_byte"] = benchmark::Counter(
+        buffer.size(), benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+    state.SetLabel(table ? "table" : "bitwise");
+}
+BENCHMARK(BM_Crc16Update)->Arg(0)->Arg(1);
+
+// bytes/sec draining the DMA ring in bulk, state.range(0) bytes per drain
+static void BM_DrainRxRing(benchmark::State& state){
+    HostShim::reset_state();
+    std::vector<uint8_t> frame = HostShim::build_frame(CommandState::FILE_SET, with_colors({1, 0, 0}, 60));
+    for (uint32_t i = 0; i < uart_rx_ring_len; i++){
+        UartRx::ring[i] = frame[i % frame.size()];
+    }
+    const uint32_t chunk = state.range(0);
+
+    for (auto _ : state){
+        drain_rx_ring(chunk);
+        // nothing runs the commands here, empty the queue so none are dropped
+        while (frame_queue_peek()){
+            frame_queue_pop();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * chunk);
+}
+BENCHMARK(BM_DrainRxRing)->Arg(16)->Arg(256)->Arg(uart_rx_ring_len);
+
+// commands/sec through parse_payload and the command handlers
+static void BM_ParsePayload(benchmark::State& state){
+    HostShim::reset_state();
+    const BenchCommand& command = bench_commands()[state.range(0)];
+    std::vector<uint8_t> frame = HostShim::build_frame(command.id, command.words);
+    // parse_payload starts at the version byte, just like Frame::buffer
+    std::vector<uint8_t> buffer(frame.begin() + 1, frame.end());
+    uint8_t len = buffer[2];
+    JsonDocument result;
+
+    for (auto _ : state){
+        result.clear();
+        parse_payload(result, buffer.data(), len);
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(command.name);
+}
+BENCHMARK(BM_ParsePayload)->DenseRange(0, 7);
+
+// parse, handle, serialize and write the reply, the same span as status["Timing"]["e2e"]
+// state.range(1) picks the JSON (0) or binary (1) reply
+static void BM_HandlePendingCommand(benchmark::State& state){
+    HostShim::reset_state();
+    light_config.binary_reply = state.range(1);
+    const BenchCommand& command = bench_commands()[state.range(0)];
+    std::vector<uint8_t> frame = HostShim::build_frame(command.id, command.words);
+    JsonDocument result;
+
+    for (auto _ : state){
+        state.PauseTiming();
+        for (uint8_t b : frame){
+            process_byte(b);
+        }
+        HostShim::uart_tx.clear();
+        state.ResumeTiming();
+
+        handle_pending_command(result);
+        benchmark::DoNotOptimize(HostShim::uart_tx);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["reply_bytes"] = HostShim::uart_tx.size();
+    state.SetLabel(command.name);
+}
+BENCHMARK(BM_HandlePendingCommand)->ArgsProduct({{0, 2, 6, 7}, {0, 1}});
+
+// COLOR_SETs/sec sent one per frame (0) or packed into a single BATCH frame (1), bytes in through reply out
+static void BM_BatchColorSet(benchmark::State& state){
+    HostShim::reset_state();
+    constexpr int count = 15;
+    std::vector<std::vector<uint8_t>> frames;
+    if (state.range(0)){
+        std::vector<uint32_t> words;
+        for (int i = 0; i < count; i++){
+            words.insert(words.end(), {((uint32_t) CommandState::COLOR_SET << 24) | 3, 0, (uint32_t) i, 0x00FF00});
+        }
+        frames.push_back(HostShim::build_frame(CommandState::BATCH, words));
+    }
+    else{
+        for (int i = 0; i < count; i++){
+            frames.push_back(HostShim::build_frame(CommandState::COLOR_SET, {0, (uint32_t) i, 0x00FF00}));
+        }
+    }
+    JsonDocument result;
+    size_t wire_bytes = 0;
+
+    for (auto _ : state){
+        HostShim::uart_tx.clear();
+        for (const auto& frame : frames){
+            for (uint8_t b : frame){
+                process_byte(b);
+            }
+            handle_pending_command(result);
+        }
+        wire_bytes = HostShim::uart_tx.size();
+        for (const auto& frame : frames){
+            wire_bytes += frame.size();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.counters["wire_bytes"] = wire_bytes;
+    state.SetLabel(state.range(0) ? "batch" : "single");
+}
+BENCHMARK(BM_BatchColorSet)->Arg(0)->Arg(1);
+
+// a full data[] upload as 55 color FILE_SET frames (0) or 256 word stream chunks acked every 4 (1),
+// bytes in through replies out
+static void BM_FileUpload(benchmark::State& state){
+    HostShim::reset_state();
+    // file 0 gives its block up so the whole of data[] is free
+    arena_free(0);
+    constexpr uint32_t total = max_data_len;
+    std::vector<uint32_t> words = with_colors({}, total);
+    std::vector<std::vector<uint8_t>> frames;
+    if (state.range(0)){
+        frames.push_back(HostShim::build_frame(CommandState::STREAM_START, {1, 0, total, 4}));
+        uint16_t seq = 0;
+        for (uint32_t i = 0; i < total; i += 256, seq++){
+            std::vector<uint32_t> chunk(words.begin() + i, words.begin() + std::min(i + 256, total));
+            frames.push_back(HostShim::build_stream_chunk(seq, chunk));
+        }
+    }
+    else{
+        // the same chunking set_color_array_file uses
+        for (uint32_t i = 0; i < total; i += 55){
+            std::vector<uint32_t> chunk = {1, 0, i != 0};
+            chunk.insert(chunk.end(), words.begin() + i, words.begin() + std::min(i + 55, total));
+            frames.push_back(HostShim::build_frame(CommandState::FILE_SET, chunk));
+        }
+    }
+    JsonDocument result;
+    size_t wire_bytes = 0;
+
+    for (auto _ : state){
+        HostShim::uart_tx.clear();
+        for (const auto& frame : frames){
+            for (uint8_t b : frame){
+                process_byte(b);
+            }
+            while (handle_pending_command(result));
+        }
+        wire_bytes = HostShim::uart_tx.size();
+        for (const auto& frame : frames){
+            wire_bytes += frame.size();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * total);
+    state.counters["wire_bytes"] = wire_bytes;
+    state.counters["frames"] = frames.size();
+    state.SetLabel(state.range(0) ? "stream" : "file_set");
+}
+BENCHMARK(BM_FileUpload)->Arg(0)->Arg(1);
+
+// time per LED to decode the RLE data into a frame, state.range(1) LEDs per run.
+// state.range(2) picks the original volatile decoder (0) or the RLE kernel build_next_frame uses (1)
+static void BM_BuildNextFrame(benchmark::State& state){
+    HostShim::reset_state();
+    const int led_count = state.range(0);
+    const int run_len = state.range(1);
+    const int entries = led_count / run_len;
+    for (int i = 0; i < entries; i++){
+        data[i] = (rgb_to_int(i, 0x20, 255 - i) << 8) | run_len;
+    }
+    files.start[0] = 0;
+    files.end[0] = entries - 1;
+    files.action[0] = EndAction::REPEAT;
+    playback_location = 0;
+    light_config.led_count = led_count;
+
+    uint32_t next_frame[max_led_len];
+
+    const bool kernel = state.range(2);
+
+    for (auto _ : state){
+        if (kernel){
+            build_next_frame(next_frame);
+        }
+        else{
+            build_rle_frame_reference(next_frame);
+        }
+        benchmark::DoNotOptimize(next_frame);
+    }
+    state.counters["time_per_led"] = benchmark::Counter(
+        led_count, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+    state.SetLabel(kernel ? "kernel" : "reference");
+}
+BENCHMARK(BM_BuildNextFrame)->ArgsProduct({{50, 250}, {1, 10}, {0, 1}});
+
+// the same frame builder on state.range(0) LEDs stored in each of the packed FileFormats
+static void BM_BuildPackedFrame(benchmark::State& state){
+    HostShim::reset_state();
+    const int led_count = state.range(0);
+    const FileFormat format = (FileFormat) state.range(1);
+    const int words = led_count / leds_per_word(format);
+    const uint16_t palette = 1024;
+    for (int i = 0; i < 256; i++){
+        data[palette + i] = (rgb_to_int(i, 0x20, 255 - i) << 8) | 1;
+    }
+    for (int i = 0; i < words; i++){
+        data[i] = 0x9E37'79B9 * (i + 1);
+    }
+    files.start[0] = 0;
+    files.end[0] = words - 1;
+    files.format[0] = format;
+    // the palette is file 1's words
+    files.start[1] = palette;
+    files.reserved[1] = 256;
+    files.palette[0] = 1;
+    playback_location = 0;
+    playback_slot = 0;
+    light_config.led_count = led_count;
+
+    uint32_t next_frame[max_led_len];
+
+    for (auto _ : state){
+        build_next_frame(next_frame);
+        benchmark::DoNotOptimize(next_frame);
+    }
+    state.counters["time_per_led"] = benchmark::Counter(
+        led_count, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+    const char* names[] = {"rle", "rgb565", "palette8", "palette4"};
+    state.SetLabel(names[(uint8_t) format]);
+}
+BENCHMARK(BM_BuildPackedFrame)->ArgsProduct({{max_led_len}, {
+    (uint8_t) FileFormat::RGB565, (uint8_t) FileFormat::PALETTE8, (uint8_t) FileFormat::PALETTE4
+}});
+
+// a DELTA file changing state.range(0) single LEDs a frame out of max_led_len, against the full RLE frames above
+static void BM_BuildDeltaFrame(benchmark::State& state){
+    HostShim::reset_state();
+    const uint32_t changes = state.range(0);
+    const uint32_t frames = 8;
+    uint32_t index = 0;
+    for (uint32_t frame = 0; frame < frames; frame++){
+        data[index++] = changes;
+        for (uint32_t change = 0; change < changes; change++){
+            uint32_t led = (change * 97 + frame * 31) % max_led_len;
+            data[index++] = (led << 16) | 1;
+            data[index++] = (rgb_to_int(frame, led, 0x40) << 8) | 1;
+        }
+    }
+    files.start[0] = 0;
+    files.end[0] = index - 1;
+    files.format[0] = FileFormat::DELTA;
+    playback_location = 0;
+    light_config.led_count = max_led_len;
+
+    uint32_t next_frame[max_led_len];
+
+    for (auto _ : state){
+        build_next_frame(next_frame);
+        benchmark::DoNotOptimize(next_frame);
+    }
+    state.counters["words_per_frame"] = index / frames;
+}
+BENCHMARK(BM_BuildDeltaFrame)->Arg(1)->Arg(10)->Arg(50)->Arg(125);
+
+// a KEYFRAME file fading between two full frames over state.range(0) frames, the keyframes are
+// only decoded at the start of each fade so the longer fade shows the per LED cost on its own
+static void BM_BuildKeyframeFrame(benchmark::State& state){
+    HostShim::reset_state();
+    const uint32_t duration = state.range(0);
+    uint32_t index = 0;
+    for (uint32_t keyframe = 0; keyframe < 2; keyframe++){
+        data[index++] = ((keyframe * duration) << 16) | max_led_len;
+        for (uint32_t led = 0; led < max_led_len; led++){
+            data[index++] = (rgb_to_int(led, keyframe * 0x80, 255 - led) << 8) | 1;
+        }
+    }
+    data[index++] = ((2 * duration) << 16) | 0;
+    files.start[0] = 0;
+    files.end[0] = index - 1;
+    files.format[0] = FileFormat::KEYFRAME;
+    playback_location = 0;
+    playback_slot = 0;
+    light_config.led_count = max_led_len;
+
+    uint32_t next_frame[max_led_len];
+
+    for (auto _ : state){
+        build_next_frame(next_frame);
+        benchmark::DoNotOptimize(next_frame);
+    }
+    state.counters["time_per_led"] = benchmark::Counter(
+        max_led_len, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+}
+BENCHMARK(BM_BuildKeyframeFrame)->Arg(4)->Arg(1000);
+
+// a 1500 word RLE file played from state.range(0), a StorageKind. outside SRAM every frame is a copy
+// out of the staging buffer the last frame read ahead into, on the host a file read stands in for the bus
+static void BM_BuildStoredFrame(benchmark::State& state){
+    HostShim::reset_state();
+    const StorageKind storage = (StorageKind) state.range(0);
+    std::vector<uint32_t> words;
+    // 3000 LEDs, a whole number of frames
+    for (uint32_t i = 0; i < 1500; i++){
+        words.push_back((rgb_to_int(i, i >> 3, 0x40) << 8) | (i % 5 == 0 ? 6 : 1));
+    }
+    HostShim::storage_load(storage, 0, words);
+    files.start[0] = 0;
+    files.end[0] = words.size() - 1;
+    files.storage[0] = storage;
+    playback_location = 0;
+    light_config.led_count = max_led_len;
+
+    uint32_t next_frame[max_led_len];
+
+    for (auto _ : state){
+        build_next_frame(next_frame);
+        benchmark::DoNotOptimize(next_frame);
+    }
+    state.counters["misses"] = Prefetch::misses;
+}
+BENCHMARK(BM_BuildStoredFrame)->Arg((int) StorageKind::SRAM)->Arg((int) StorageKind::PSRAM);
+
+// boot with a full data[] saved, a checkpoint then state.range(0) pages of small changes after it
+static void BM_FlashStoreLoad(benchmark::State& state){
+    HostShim::reset_state();
+    flash_store_format();
+    for (uint32_t i = 0; i < max_data_len; i++){
+        data[i] = (rgb_to_int(i, i >> 4, 0x40) << 8) | 1;
+    }
+    flash_store_mark_data(0, max_data_len);
+    flash_store_flush();
+    for (int64_t i = 0; i < state.range(0); i++){
+        data[i % max_data_len] = i;
+        flash_store_mark_data(i % max_data_len, 1);
+        flash_store_flush();
+    }
+
+    for (auto _ : state){
+        benchmark::DoNotOptimize(flash_store_load());
+    }
+    state.counters["pages"] = FlashStore::head - FlashStore::checkpoint;
+    flash_store_format();
+}
+BENCHMARK(BM_FlashStoreLoad)->Arg(0)->Arg(500);
+
+// data[] split evenly between every file with every other one freed, then one compaction step (0),
+// the longest core 1 stalls between frames, or closing up every hole (1)
+static void BM_ArenaCompact(benchmark::State& state){
+    HostShim::reset_state();
+    arena_free(0);
+    constexpr uint32_t block = max_data_len / max_file_len;
+    uint32_t moved = 0;
+
+    for (auto _ : state){
+        state.PauseTiming();
+        for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+            files.start[file_id] = file_id * block;
+            files.end[file_id] = files.start[file_id] + block - 1;
+            files.reserved[file_id] = file_id % 2 ? block : 0;
+        }
+        arena_reset();
+        state.ResumeTiming();
+        if (state.range(0)){
+            arena_compact();
+        }
+        else{
+            benchmark::DoNotOptimize(arena_compact_step());
+        }
+        moved = Arena::words_moved;
+    }
+    state.counters["words_moved"] = moved;
+    state.SetLabel(state.range(0) ? "compact" : "step");
+}
+BENCHMARK(BM_ArenaCompact)->Arg(0)->Arg(1);
+
+// each of the built in effects rendered over max_led_len LEDs, no data[] behind any of them
+static void BM_Effect(benchmark::State& state){
+    HostShim::reset_state();
+    const EffectId effect = (EffectId) state.range(0);
+    Effects::settings[0] = {effect, {0x180, 0xFF8020, 200}};
+    files.action[0] = EndAction::FUNCTION;
+    playback_location = 0;
+    light_config.led_count = max_led_len;
+
+    uint32_t next_frame[max_led_len];
+
+    for (auto _ : state){
+        build_next_frame(next_frame);
+        benchmark::DoNotOptimize(next_frame);
+    }
+    state.counters["time_per_led"] = benchmark::Counter(
+        max_led_len, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+    state.SetLabel(effect_registry[(uint8_t) effect].name);
+}
+BENCHMARK(BM_Effect)->DenseRange(0, effect_count - 1);
+
+// time spent in the frame timer IRQ, with the copy and RLE decode done in the IRQ (0)
+// or rendered ahead on core 1 so the IRQ only swaps buffers (1)
+static void BM_FrameTimerIrq(benchmark::State& state){
+    HostShim::reset_state();
+    for (int i = 0; i < max_led_len; i++){
+        data[i] = (rgb_to_int(i, 0x20, 255 - i) << 8) | 1;
+    }
+    files.end[0] = max_led_len - 1;
+    light_config.led_count = max_led_len;
+    static uint32_t current_frame[max_led_len];
+    static uint32_t next_frame[max_led_len];
+    const bool ping_pong = state.range(0);
+
+    for (auto _ : state){
+        if (ping_pong){
+            // stands in for core 1 having rendered, see BM_BuildNextFrame for what that costs over there
+            FrameBuffer::back_ready.store(true, std::memory_order_release);
+            benchmark::DoNotOptimize(frame_buffer_swap());
+        }
+        else{
+            memcpy(current_frame, next_frame, sizeof(next_frame));
+            build_next_frame(next_frame);
+            benchmark::DoNotOptimize(current_frame);
+        }
+    }
+    state.SetLabel(ping_pong ? "swap" : "copy_and_build");
+}
+BENCHMARK(BM_FrameTimerIrq)->Arg(0)->Arg(1);
+
+// turning a frame into the byte per bit stream for parallel output, state.range(0) LEDs per strip over 8 strips.
+// the frame is still max_led_len long, so a full frame is 31 each. state.range(1) picks the bit at a time
+// reference (0) or the SWAR kernel (1)
+static void BM_TransposeStrips(benchmark::State& state){
+    HostShim::reset_state();
+    const uint16_t per_strip = state.range(0);
+    const bool swar = state.range(1);
+    layout_strips_evenly(max_strips, per_strip * max_strips);
+    static uint32_t frame[max_led_len];
+    for (uint32_t i = 0; i < per_strip * max_strips; i++){
+        frame[i] = (rgb_to_int(i, 0x20, 255 - i) << 8) | 1;
+    }
+    static uint32_t wire[max_led_len * parallel_words_per_led];
+
+    for (auto _ : state){
+        if (swar){
+            benchmark::DoNotOptimize(transpose_strips(frame, max_strips, wire));
+        }
+        else{
+            benchmark::DoNotOptimize(transpose_strips_reference(frame, max_strips, wire));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * per_strip * max_strips);
+    state.counters["leds_per_us"] = benchmark::Counter(
+        per_strip * max_strips / 1e6, benchmark::Counter::kIsIterationInvariantRate
+    );
+    state.SetLabel(swar ? "swar" : "reference");
+}
+BENCHMARK(BM_TransposeStrips)->ArgsProduct({{8, max_led_len / max_strips}, {0, 1}});
+
+// the output stage over state.range(0) LEDs. state.range(1) is what it does:
+// 0 is the plain frame copy the IRQ used to do, 1 brightness, gain and reorder, 2 adds gamma and 3 adds ordered dither,
+// 4 is 3 through apply_output_stage_reference, without the kernel picked for the color order
+static void BM_OutputStage(benchmark::State& state){
+    HostShim::reset_state();
+    const uint32_t led_count = state.range(0);
+    const int mode = state.range(1);
+    std::vector<uint32_t> frame(led_count);
+    std::vector<uint32_t> copy(led_count);
+    for (uint32_t i = 0; i < led_count; i++){
+        frame[i] = (rgb_to_int(i, 0x20, 255 - i) << 8) | 1;
+    }
+    if (mode >= 1){
+        light_config.brightness = 200;
+        light_config.channel_gain = 0xFFE0C0;
+        light_config.color_order = (uint8_t) ColorOrder::GRB;
+    }
+    if (mode >= 2){
+        light_config.gamma = 0x030303;
+    }
+    if (mode >= 3){
+        light_config.dither = (uint8_t) DitherMode::ORDERED;
+    }
+    const bool reference = mode == 4;
+
+    for (auto _ : state){
+        if (mode == 0){
+            memcpy(copy.data(), frame.data(), led_count * sizeof(uint32_t));
+        }
+        else if (reference){
+            apply_output_stage_reference(frame.data(), led_count);
+        }
+        else{
+            apply_output_stage(frame.data(), led_count);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.counters["time_per_led"] = benchmark::Counter(
+        led_count, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+    const char* labels[] = {"raw_copy", "brightness", "gamma", "gamma_dither", "gamma_dither_reference"};
+    state.SetLabel(labels[mode]);
+}
+BENCHMARK(BM_OutputStage)->ArgsProduct({{max_led_len, 1000}, {0, 1, 2, 3, 4}});
+
+// TEMPORAL dither over state.range(0) LEDs. the per refresh pass (0) is all that runs between content frames,
+// loading a new frame through the tables (1) happens once every refreshes_per_frame
+static void BM_TemporalDither(benchmark::State& state){
+    HostShim::reset_state();
+    const uint32_t led_count = state.range(0);
+    light_config.dither = (uint8_t) DitherMode::TEMPORAL;
+    light_config.gamma = 0x030303;
+    uint32_t frame[max_led_len];
+    for (uint32_t i = 0; i < led_count; i++){
+        frame[i] = (rgb_to_int(i, 0x20, 255 - i) << 8) | 1;
+    }
+    load_temporal_frame(frame, led_count);
+    const bool load = state.range(1);
+
+    for (auto _ : state){
+        if (load){
+            load_temporal_frame(frame, led_count);
+        }
+        else{
+            temporal_dither_frame(frame, led_count);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.counters["time_per_led"] = benchmark::Counter(
+        led_count, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+    state.SetLabel(load ? "load" : "refresh");
+}
+BENCHMARK(BM_TemporalDither)->ArgsProduct({{50, max_led_len}, {0, 1}});
+
+BENCHMARK_MAIN();
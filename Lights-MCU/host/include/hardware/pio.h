@@ -0,0 +1,10 @@
+#ifndef HOST_HARDWARE_PIO_H
+#define HOST_HARDWARE_PIO_H
+
+#include "pico.h"
+
+// only the handle type is needed so Pio_SM_info compiles, there is no PIO on the host
+struct pio_hw_t;
+typedef pio_hw_t *PIO;
+
+#endif // HOST_HARDWARE_PIO_H
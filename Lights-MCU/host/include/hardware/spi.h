@@ -0,0 +1,10 @@
+#ifndef HOST_HARDWARE_SPI_H
+#define HOST_HARDWARE_SPI_H
+
+#include "pico.h"
+
+// light_hal.h names spi0, nothing on the host talks to it
+struct spi_inst;
+#define spi0 ((spi_inst *) nullptr)
+
+#endif // HOST_HARDWARE_SPI_H
@@ -0,0 +1,21 @@
+#ifndef HOST_HARDWARE_UART_H
+#define HOST_HARDWARE_UART_H
+
+#include "pico.h"
+
+struct uart_inst_t {
+    uint index;
+};
+
+extern uart_inst_t host_uart0;
+extern uart_inst_t host_uart1;
+
+#define uart0 (&host_uart0)
+#define uart1 (&host_uart1)
+
+// everything written to either UART is captured into HostShim::uart_tx
+void uart_putc_raw(uart_inst_t *uart, char c);
+void uart_putc(uart_inst_t *uart, char c);
+void uart_puts(uart_inst_t *uart, const char *s);
+
+#endif // HOST_HARDWARE_UART_H
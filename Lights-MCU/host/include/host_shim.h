@@ -0,0 +1,29 @@
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "parsing.h"
+#include "files.h"
+
+// Hooks into the host stand-ins for the Pico SDK, for tests and benchmarks
+namespace HostShim{
+
+    // every byte written through uart_puts / uart_putc_raw / putchar_raw
+    extern std::string uart_tx;
+
+    // reset the parser and animation state back to how the firmware boots
+    void reset_state();
+
+    // a complete request frame, same layout as send_command in test/python_testing/test_serial.py
+    std::vector<uint8_t> build_frame(CommandState id, const std::vector<uint32_t>& words);
+
+    // one chunk of a streaming upload, same layout as stream_file in test/python_testing/test_serial.py
+    std::vector<uint8_t> build_stream_chunk(uint16_t seq, const std::vector<uint32_t>& words);
+
+    // put words straight into a storage backend, rather than a FILE_SET at a time
+    bool storage_load(StorageKind kind, uint32_t index, const std::vector<uint32_t>& words);
+};
+
+#endif // HOST_SHIM_H
@@ -0,0 +1,18 @@
+#ifndef HOST_PICO_H
+#define HOST_PICO_H
+
+// Host stand-in for the handful of Pico SDK base definitions used by the core sources.
+// Only compiled into the lights_core host build, never into the firmware.
+
+#include <cstdint>
+#include <cstddef>
+
+typedef unsigned int uint;
+
+// the SDK sets this to 1 when building for the RP2040, anything hardware only is behind it
+#define PICO_ON_DEVICE 0
+
+// the SDK's busy wait hint, nothing to do on the host
+static inline void tight_loop_contents(){}
+
+#endif // HOST_PICO_H
@@ -0,0 +1,15 @@
+#ifndef HOST_PICO_MUTEX_H
+#define HOST_PICO_MUTEX_H
+
+#include <mutex>
+#include "pico.h"
+
+struct mutex_t {
+    std::mutex lock;
+};
+
+void mutex_init(mutex_t *mtx);
+void mutex_enter_blocking(mutex_t *mtx);
+void mutex_exit(mutex_t *mtx);
+
+#endif // HOST_PICO_MUTEX_H
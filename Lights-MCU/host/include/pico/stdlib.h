@@ -0,0 +1,10 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+#include "pico.h"
+#include "pico/time.h"
+
+// stdio over UART and USB, captured into HostShim::uart_tx on the host
+int putchar_raw(int c);
+
+#endif // HOST_PICO_STDLIB_H
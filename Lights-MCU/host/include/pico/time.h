@@ -0,0 +1,9 @@
+#ifndef HOST_PICO_TIME_H
+#define HOST_PICO_TIME_H
+
+#include "pico.h"
+
+// microseconds since the host process started, wrapping like the RP2040 timer
+uint32_t time_us_32();
+
+#endif // HOST_PICO_TIME_H
@@ -0,0 +1,139 @@
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "pico/time.h"
+#include "pico/mutex.h"
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "host_shim.h"
+
+#include "parsing.h"
+#include "playback.h"
+#include "crc16.h"
+#include "uart_rx.h"
+#include "frame_queue.h"
+#include "frame_buffer.h"
+#include "effects.h"
+#include "led_sequence.h"
+#include "storage.h"
+#include "flash_store.h"
+#include "arena.h"
+
+
+uart_inst_t host_uart0 = {0};
+uart_inst_t host_uart1 = {1};
+
+namespace HostShim{
+    std::string uart_tx;
+};
+
+
+uint32_t time_us_32(){
+    static const auto boot = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::now() - boot;
+    return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void mutex_init(mutex_t *mtx){
+    // std::mutex is ready to use once constructed
+    (void) mtx;
+}
+
+void mutex_enter_blocking(mutex_t *mtx){
+    mtx->lock.lock();
+}
+
+void mutex_exit(mutex_t *mtx){
+    mtx->lock.unlock();
+}
+
+int putchar_raw(int c){
+    HostShim::uart_tx.push_back((char) c);
+    return c;
+}
+
+void uart_putc_raw(uart_inst_t *uart, char c){
+    (void) uart;
+    HostShim::uart_tx.push_back(c);
+}
+
+void uart_putc(uart_inst_t *uart, char c){
+    uart_putc_raw(uart, c);
+}
+
+void uart_puts(uart_inst_t *uart, const char *s){
+    while (*s){
+        uart_putc(uart, *s++);
+    }
+}
+
+void HostShim::reset_state(){
+    Parsing::uart_parsing_state = ParseState::WAIT_START;
+    Parsing::uart_working_index = 0;
+    Parsing::payload_len = 0;
+    frame_queue_clear();
+    Stream::active = false;
+    Stream::expected_seq = 0;
+    Stream::chunks_since_ack = 0;
+    Stream::finished = 0;
+
+    UartRx::read_index = 0;
+    UartRx::bytes_received = 0;
+    UartRx::overrun_count = 0;
+    UartRx::overrun_bytes = 0;
+    UartRx::high_water = 0;
+
+    memcpy((void*) &light_config, &default_light_config, sizeof(Animation_Config));
+    current_file = 0;
+    working_frame_index = 0;
+    file_table_clear();
+    for (auto& word : data){
+        word = 0;
+    }
+    for (auto& effect : Effects::settings){
+        effect = {};
+    }
+    for (auto& duration : LedSequence::durations_ms){
+        duration = 0;
+    }
+    prefetch_clear();
+    arena_reset();
+    // the flash itself is left alone, the same as a reboot
+    flash_store_reset();
+    frame_buffer_clear();
+    default_file_0();
+
+    uart_tx.clear();
+}
+
+std::vector<uint8_t> HostShim::build_frame(CommandState id, const std::vector<uint32_t>& words){
+    std::vector<uint8_t> packet = {(uint8_t) START_CONDITION, 0x01, (uint8_t) id, (uint8_t) (words.size()*4)};
+    for (uint32_t word : words){
+        packet.push_back(word >> 24);
+        packet.push_back(word >> 16);
+        packet.push_back(word >> 8);
+        packet.push_back(word);
+    }
+    uint16_t crc = crc16(&packet[1], packet.size() - 1);
+    packet.push_back(crc >> 8);
+    packet.push_back(crc & 0xFF);
+    packet.push_back((uint8_t) END_CONDITION);
+    return packet;
+}
+
+std::vector<uint8_t> HostShim::build_stream_chunk(uint16_t seq, const std::vector<uint32_t>& words){
+    uint16_t len = words.size()*4;
+    std::vector<uint8_t> packet = {(uint8_t) STREAM_START_CONDITION, (uint8_t) (seq >> 8), (uint8_t) seq, (uint8_t) (len >> 8), (uint8_t) len};
+    for (uint32_t word : words){
+        packet.push_back(word >> 24);
+        packet.push_back(word >> 16);
+        packet.push_back(word >> 8);
+        packet.push_back(word);
+    }
+    uint16_t crc = crc16(&packet[1], packet.size() - 1);
+    packet.push_back(crc >> 8);
+    packet.push_back(crc & 0xFF);
+    packet.push_back((uint8_t) END_CONDITION);
+    return packet;
+}
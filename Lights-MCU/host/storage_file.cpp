@@ -0,0 +1,113 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "host_shim.h"
+#include "storage.h"
+#include "flash_store.h"
+
+
+// XIP flash and PSRAM are both plain files on the host, a temporary one unless the environment
+// names an image to use (LIGHTS_XIP_IMAGE, LIGHTS_PSRAM_IMAGE)
+static FILE* xip_file = nullptr;
+static FILE* psram_file = nullptr;
+
+static FILE* open_store(FILE*& file, const char* env){
+    if (file == nullptr){
+        const char* path = getenv(env);
+        if (path != nullptr){
+            file = fopen(path, "r+b");
+            if (file == nullptr){
+                file = fopen(path, "w+b");
+            }
+        }
+        else{
+            file = tmpfile();
+        }
+    }
+    return file;
+}
+
+static bool file_read(FILE* file, uint32_t word_count, uint32_t index, uint32_t* dest, uint32_t count){
+    if (file == nullptr or index + count > word_count){
+        return false;
+    }
+    fseek(file, (long) index * sizeof(uint32_t), SEEK_SET);
+    size_t got = fread(dest, sizeof(uint32_t), count, file);
+    // anything past what has been written reads back as zero
+    memset(&dest[got], 0, (count - got) * sizeof(uint32_t));
+    return true;
+}
+
+static bool file_write(FILE* file, uint32_t word_count, uint32_t index, const uint32_t* src, uint32_t count){
+    if (file == nullptr or index + count > word_count){
+        return false;
+    }
+    fseek(file, (long) index * sizeof(uint32_t), SEEK_SET);
+    bool written = fwrite(src, sizeof(uint32_t), count, file) == count;
+    fflush(file);
+    return written;
+}
+
+static bool xip_read(uint32_t index, uint32_t* dest, uint32_t count){
+    return file_read(open_store(xip_file, "LIGHTS_XIP_IMAGE"), storage_xip_words, index, dest, count);
+}
+
+static bool psram_read(uint32_t index, uint32_t* dest, uint32_t count){
+    return file_read(open_store(psram_file, "LIGHTS_PSRAM_IMAGE"), storage_psram_words, index, dest, count);
+}
+
+static bool xip_write(uint32_t index, const uint32_t* src, uint32_t count){
+    return file_write(open_store(xip_file, "LIGHTS_XIP_IMAGE"), storage_xip_words, index, src, count);
+}
+
+static bool psram_write(uint32_t index, const uint32_t* src, uint32_t count){
+    return file_write(open_store(psram_file, "LIGHTS_PSRAM_IMAGE"), storage_psram_words, index, src, count);
+}
+
+static bool read_done(){
+    // start_read has already finished by the time it returns
+    return true;
+}
+
+const StorageBackend xip_flash_backend = {"xip_flash", storage_xip_words, xip_read, xip_write, xip_read, read_done};
+const StorageBackend psram_backend = {"psram", storage_psram_words, psram_read, psram_write, psram_read, read_done};
+
+bool HostShim::storage_load(StorageKind kind, uint32_t index, const std::vector<uint32_t>& words){
+    return storage_write(kind, index, words.data(), words.size());
+}
+
+
+// the log region of flash, held in memory so it lasts through HostShim::reset_state the same as a reboot.
+// programming can only clear bits, like the real thing, so writing a page twice without an erase shows up
+static uint8_t flash_image[flash_store_bytes];
+static bool flash_image_ready = false;
+
+const uint8_t* flash_store_map(){
+    if (!flash_image_ready){
+        memset(flash_image, 0xFF, sizeof(flash_image));
+        flash_image_ready = true;
+    }
+    return flash_image;
+}
+
+bool flash_store_erase(uint32_t offset){
+    flash_store_map();
+    if (offset % flash_sector_bytes != 0 or offset >= flash_store_bytes){
+        return false;
+    }
+    memset(&flash_image[offset], 0xFF, flash_sector_bytes);
+    return true;
+}
+
+bool flash_store_program(uint32_t offset, const uint8_t* src){
+    flash_store_map();
+    if (offset % flash_page_bytes != 0 or offset >= flash_store_bytes){
+        return false;
+    }
+    for (uint32_t i = 0; i < flash_page_bytes; i++){
+        flash_image[offset + i] &= src[i];
+    }
+    return true;
+}
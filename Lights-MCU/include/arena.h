@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    /*
+        data[] is handed out to files by the firmware rather than the host picking where each one goes.
+        Every SRAM file owns one block, File.start for File.reserved words, and the file itself is
+        File.start to File.end inside that. Nothing else keeps track, so the block list is the file table and
+        goes through a power cycle with it.
+        Blocks are placed first fit. Freeing one leaves a hole, which arena_compact_step closes up a
+        block at a time from core 1 in between frames, so playback never sees a file half moved.
+        Once there are no holes left it does nothing until something else is freed or moved.
+        The host refers to a file by its id, never its place in data[].
+    */
+    namespace Arena{
+        extern volatile uint32_t moves; // blocks compaction has moved
+        extern volatile uint32_t words_moved;
+        // as of the last time compaction ran out of work, for the status report on core 0
+        extern volatile uint32_t free_words;
+        extern volatile uint32_t largest_free;
+    };
+
+    // give file_id a block of at least words, its old contents are dropped unless the block it
+    // already had is big enough. false if there isn't that much free, nothing changes then
+    bool arena_reserve(uint8_t file_id, uint32_t words);
+    // make the block of file_id at least words, keeping what is in it. it may move
+    bool arena_grow(uint8_t file_id, uint32_t words);
+    // hand the block of file_id back
+    void arena_free(uint8_t file_id);
+
+    // move the lowest block with a gap below it down into the gap, false if there was nothing to move
+    bool arena_compact_step();
+    // move everything down until there are no gaps
+    void arena_compact();
+    // files[] was changed behind the arena's back, look at all of it again. zeroes the counters
+    void arena_reset();
+
+    // these walk the whole table and share a buffer with the rest, core 1 only
+    uint32_t arena_free_words();
+    uint32_t arena_largest_free();
+
+#endif // ARENA_H
@@ -0,0 +1,47 @@
+#ifndef COMMS_H
+#define COMMS_H
+
+    #include <cstdint>
+    #include "pico/mutex.h"
+    #include <ArduinoJson-v7.4.2.h>
+
+    extern mutex_t uart_mutex;
+    extern volatile uint32_t time_last_byte_recvd;
+
+    extern char uart_buff[250];
+    extern JsonDocument status;
+
+    void output_byte(uint8_t b);
+    void uart_out(char* buffer, int buffer_len);
+    // same as uart_out but writes exactly buffer_len bytes, for binary data that can hold NULLs
+    void uart_write(const uint8_t* buffer, int buffer_len);
+
+    /*
+        Binary reply, mirrors the request framing. Selected with ConfigIndex::binary_reply
+        [1 B]   [1 B]       [1 B]           [1 B]               [1 B]   [4*N B]     [2 B]       [1 B]
+        [Start] [Version]   [Command ID]    [Payload Length]    [Error] [Value(s)]  [CRC]       [End]
+        Values are big endian uint32, FILE_GET sends back all four of its values. A reply with more
+        values than fit in buffer_len goes out as OUT_OF_RANGE with no values instead
+    */
+    uint8_t serialize_binary_reply(JsonDocument& result, uint8_t cmd_id, uint8_t* buffer, uint8_t buffer_len);
+
+    // entries in one FILE_LIST reply, so it holds uart_mutex no longer than any other reply
+    constexpr uint16_t file_list_page_len = 16;
+
+    /*
+        FILE_LIST always gets this back, a page at a time from the first file id asked for
+        [1 B]           [1 B]       [1 B]           [2 B]               [1 B]   [1 word]    [12*N B]    [2 B]   [1 B]
+        [Stream Start]  [Version]   [Command ID]    [Payload Length]    [Error] [Next Id]   [Entries]   [CRC]   [End]
+        Up to file_list_page_len entries for the files in use from first, lowest id first.
+        Next Id is what to ask for next, max_file_len once the whole table has been sent
+        [1 word]                                            [1 word]    [1 word]
+        [Id << 24 | Action << 16 | Format << 8 | Storage]   [Start]     [End]
+        Written out as it goes rather than built up in a buffer first
+    */
+    void send_file_list(uint16_t first);
+
+    // run the oldest frame waiting in the FrameQueue and send the reply back out.
+    // returns false if there was nothing waiting
+    bool handle_pending_command(JsonDocument& result);
+
+#endif // COMMS_H
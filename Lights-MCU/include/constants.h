@@ -3,21 +3,36 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
     #include <cstdint>
-    constexpr uint8_t max_frame_len = 1;
+    constexpr uint8_t max_frame_len = 32; // led_frame is 32 KB at max_led_len
     constexpr uint8_t max_led_len = 250;
-    constexpr uint8_t uart_buffer_len = 255;
     constexpr uint32_t max_data_len = 3000;
+    constexpr uint16_t max_file_len = 256; // every id a uint8_t can hold
     // 20_000 is ok
 
     constexpr char START_CONDITION = 0xAA;
     constexpr char END_CONDITION = 0x55;
-    constexpr uint8_t CRC_LEN = 0x01;
+    // starts a STREAM chunk instead of a command frame, see Stream in parsing.h
+    constexpr char STREAM_START_CONDITION = 0xAB;
+    constexpr uint8_t STREAM_HEADER_LEN = 0x04; // sequence + length, both 16 bit
+    constexpr uint8_t CRC_LEN = 0x02; // CRC-16, high byte first
     constexpr uint8_t HEADER_LEN = 0x03;
+    // version through CRC for the longest payload the length byte can describe
+    constexpr uint16_t frame_buffer_len = HEADER_LEN + 0xFF + CRC_LEN;
+    // complete frames that can wait between the parser on core 0 and core 1, must be a power of two
+    constexpr uint8_t frame_queue_len = 8;
+    // most output refreshes per frame of content, for temporal dithering
+    constexpr uint8_t max_refreshes_per_frame = 16;
+    // sub-commands in one BATCH frame, one bit each in the reply
+    constexpr uint8_t max_batch_len = 32;
 
     // the amount of time that has passed that the message should be considered invalid
     // 100000 seems to work?
     constexpr uint32_t uart_invalid_timeout_us = 100000;
 
+    // hardware UART RX is written by DMA into a ring of this many bytes, must be a power of two
+    constexpr uint8_t uart_rx_ring_bits = 10;
+    constexpr uint32_t uart_rx_ring_len = 1u << uart_rx_ring_bits;
+
     
 
 #endif // CONSTANTS_H
\ No newline at end of file
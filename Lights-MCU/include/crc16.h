@@ -0,0 +1,42 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+    #include <cstdint>
+
+    // CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF, no reflection, no xor out).
+    // Same as binascii.crc_hqx(data, 0xFFFF) on the python side.
+    constexpr uint16_t CRC16_INIT = 0xFFFF;
+    constexpr uint16_t CRC16_POLY = 0x1021;
+
+    struct Crc16Table {
+        uint16_t entries[256];
+    };
+
+    constexpr Crc16Table make_crc16_table(){
+        Crc16Table table = {};
+        for (int i = 0; i < 256; i++){
+            uint16_t crc = i << 8;
+            for (int bit = 0; bit < 8; bit++){
+                crc = (crc & 0x8000) ? (crc << 1) ^ CRC16_POLY : (crc << 1);
+            }
+            table.entries[i] = crc;
+        }
+        return table;
+    }
+
+    inline constexpr Crc16Table crc16_table = make_crc16_table();
+
+    // one table lookup per byte, so the parser can keep it up to date as bytes arrive
+    inline uint16_t crc16_update(uint16_t crc, uint8_t b){
+        return (crc << 8) ^ crc16_table.entries[(crc >> 8) ^ b];
+    }
+
+    inline uint16_t crc16(const volatile uint8_t* buffer, uint32_t len){
+        uint16_t crc = CRC16_INIT;
+        for (uint32_t i = 0; i < len; i++){
+            crc = crc16_update(crc, buffer[i]);
+        }
+        return crc;
+    }
+
+#endif // CRC16_H
@@ -0,0 +1,58 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    /*
+        Built in effects, worked out every frame so they take no data[] space and no uploading.
+        A file is switched over to one with EFFECT_SET, which makes its action EndAction::FUNCTION,
+        then it is played like any other file by setting current_file.
+        Speeds are 8.8 fixed point steps per frame, colors are 0xRRGGBB the same as rgb_to_int.
+
+        Effect      param 0             param 1                 param 2
+        RAINBOW     speed (hue)         hues across the strip   -
+        CHASE       speed (LEDs)        color                   width in LEDs
+        TWINKLE     speed (level)       color                   share of LEDs twinkling, 0-255
+        FIRE        cooling, 0-255      sparking, 0-255         -
+        BREATHING   speed (level)       color                   -
+    */
+    enum class EffectId : uint8_t{
+        RAINBOW = 0x00,
+        CHASE = 0x01,
+        TWINKLE = 0x02,
+        FIRE = 0x03,
+        BREATHING = 0x04,
+    };
+    constexpr uint8_t effect_count = 5;
+    constexpr uint8_t effect_param_count = 3;
+
+    struct EffectSettings{
+        EffectId id;
+        uint32_t params[effect_param_count];
+    };
+
+    // frame is led_count long, time is frames since the file started
+    typedef void (*EffectRender)(uint32_t* frame, uint16_t led_count, uint32_t time, const EffectSettings& settings);
+
+    struct Effect{
+        const char* name;
+        EffectRender render;
+    };
+
+    extern const Effect effect_registry[effect_count];
+
+    namespace Effects{
+        // what each file plays when its action is EndAction::FUNCTION
+        extern EffectSettings settings[max_file_len];
+        // how long the last frame of each effect took to render
+        extern volatile uint32_t render_us[effect_count];
+    };
+
+    // render the effect of file_id into frame and time it
+    void render_effect(uint8_t file_id, uint32_t* frame, uint16_t led_count, uint32_t time);
+
+    // 0-255 around the color wheel, red to green to blue and back to red
+    uint32_t hue_to_int(uint8_t hue);
+
+#endif // EFFECTS_H
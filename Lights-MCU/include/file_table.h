@@ -0,0 +1,44 @@
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+    #include <cstdint>
+    #include "constants.h"
+    #include "files.h"
+
+    /*
+        The file directory, indexed straight by file id. Each field is its own array so anything
+        that walks every file (the arena, the flash store, FILE_LIST) only pulls in the field it needs.
+        Every id is either in use or on the free list, FILE_NEW hands out the one freed last.
+    */
+    struct FileTable{
+        uint32_t start[max_file_len];
+        uint32_t end[max_file_len];
+        EndAction action[max_file_len];
+        FileFormat format[max_file_len];
+        StorageKind storage[max_file_len];
+        uint16_t palette[max_file_len];
+        uint32_t reserved[max_file_len];
+    };
+
+    // current_file and the rest are a uint8_t, so there is no id that isn't in the table
+    static_assert(max_file_len == 256, "file ids are one byte everywhere");
+
+    extern volatile FileTable files;
+
+    // every entry empty and back on the free list
+    void file_table_clear();
+    // take file_id off the free list, nothing happens if it is already in use
+    void file_table_use(uint8_t file_id);
+    // clear file_id and put it back on the free list
+    void file_table_release(uint8_t file_id);
+    // take a free id, false if every one is in use
+    bool file_table_new(uint8_t& file_id);
+    bool file_table_in_use(uint8_t file_id);
+    // ids in use
+    uint16_t file_table_count();
+
+    // one entry packed together, what the flash store saves
+    File file_entry(uint8_t file_id);
+    void set_file_entry(uint8_t file_id, const File& file);
+
+#endif // FILE_TABLE_H
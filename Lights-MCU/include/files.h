@@ -10,10 +10,68 @@ enum class EndAction : uint8_t{
     FUNCTION = 0x04
 };
 
+/*
+    How the words of a file are laid out in data[]. RLE is the original (color << 8 | count) per entry,
+    the rest are one LED per slot with no run length, packed first LED in the high bits of each word.
+    Palette entries are ordinary RLE words, the words of the SRAM file File.palette, the count in them is ignored.
+    LEDs per word:      RLE 1 run, RGB565 2, PALETTE8 4, PALETTE4 8
+
+    DELTA only stores the runs of LEDs that changed since the frame before, each frame being
+    [1 word]        [2 words each]
+    [Entry Count]   [First LED << 16 | Run Length] [Color << 8]
+    Playback starts from all off at the start of the file, so the first frame has everything that is lit.
+
+    KEYFRAME stores a few whole frames and fades between them, each keyframe being
+    [1 word]                        [N words]
+    [Time << 16 | Entry Count]      [RLE entries, same as the RLE format]
+    Time is in frames from the start of the file and counts up, the first keyframe is at 0.
+    Each LED is faded linearly from one keyframe to the next, the last keyframe is shown for one frame
+    and then the file REPEATs from the first or holds on it.
+*/
+enum class FileFormat : uint8_t{
+    RLE = 0x00,
+    RGB565 = 0x01,
+    PALETTE8 = 0x02,
+    PALETTE4 = 0x03,
+    DELTA = 0x04,
+    KEYFRAME = 0x05,
+};
+constexpr uint8_t file_format_count = 6;
+
+// LEDs held in one data[] word, 0 for RLE, DELTA and KEYFRAME where it depends on the contents
+constexpr uint8_t leds_per_word(FileFormat format){
+    return format == FileFormat::RGB565 ? 2 :
+           format == FileFormat::PALETTE8 ? 4 :
+           format == FileFormat::PALETTE4 ? 8 : 0;
+}
+
+// entries the palette of a format takes up in data[]
+constexpr uint16_t palette_len(FileFormat format){
+    return format == FileFormat::PALETTE8 ? 256 :
+           format == FileFormat::PALETTE4 ? 16 : 0;
+}
+
+/*
+    Where the words of a file are kept, start and end index into that backend rather than data[].
+    Anything outside SRAM is played out of a staging buffer (see storage.h), palettes always stay in data[].
+    SRAM files are placed by the arena (see arena.h), the host never picks where.
+*/
+enum class StorageKind : uint8_t{
+    SRAM = 0x00,
+    XIP_FLASH = 0x01,
+    PSRAM = 0x02,
+};
+constexpr uint8_t storage_kind_count = 3;
+
+// one entry of the file table (see file_table.h) on its own, as the flash store saves it
 struct File{
-   uint16_t start; // starting index in the data array
-   uint16_t end;   // last index of the file (if a length of 1, should be the same as start)
+   uint32_t start; // starting index in the data array
+   uint32_t end;   // last index of the file (if a length of 1, should be the same as start)
    EndAction action;
+   FileFormat format;
+   uint16_t palette; // file holding the palette, only used by the PALETTE formats
+   StorageKind storage;
+   uint32_t reserved; // words of data[] the arena has given the file from start, 0 for none
 };
 
 
@@ -0,0 +1,83 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    // the last 256 KB of the 2 MB flash, after the XIP_FLASH files (see storage.h)
+    constexpr uint32_t flash_store_offset = (2048 - 256) * 1024;
+    constexpr uint32_t flash_store_bytes = 256 * 1024;
+    constexpr uint32_t flash_page_bytes = 256; // smallest program
+    constexpr uint32_t flash_sector_bytes = 4096; // smallest erase
+    constexpr uint32_t flash_store_pages = flash_store_bytes / flash_page_bytes;
+    constexpr uint32_t flash_pages_per_sector = flash_sector_bytes / flash_page_bytes;
+
+    /*
+        The file table, data[] and light_config are kept in flash as a log, one record per 256 byte page
+        [1 word]    [1 word]    [1 word]                                        [1 word]    [1 word]    [59 words]
+        [Magic]     [Sequence]  [Type << 24 | Id << 16 | Layout << 8 | Count]   [Index]     [CRC]       [Payload]
+        Sequence counts up forever and page n of the log is at n % flash_store_pages, so it goes round
+        the whole region and every sector is erased as often as the rest.
+        Changes only mark what is dirty, flash_store_poll writes just those records once commands
+        have stopped coming in for a while, a few pages per call.
+        A CHECKPOINT record starts a full copy of everything, boot replays the newest complete one and
+        every record after it. Before the log can come round onto the oldest checkpoint a new one is
+        written, so nothing still needed is ever erased.
+        CONFIG and FILE records are the structs as they are in memory, one with a Layout or Count that
+        doesn't match this firmware's is skipped rather than loaded.
+    */
+    enum class FlashRecord : uint8_t{
+        CHECKPOINT = 0x01, // Index is how many pages the checkpoint takes
+        CONFIG = 0x02, // light_config then current_file
+        FILE = 0x03, // Id is the file, File then its EffectSettings. Index is 1 when it was freed instead
+        DATA = 0x04, // Count words of data[] from Index
+    };
+
+    constexpr uint32_t flash_record_magic = 0x4C474F4C; // "LOGL"
+    constexpr uint32_t flash_record_header_words = 5;
+    // bumped whenever Animation_Config, File or EffectSettings change
+    constexpr uint8_t flash_record_layout = 1;
+    constexpr uint32_t flash_record_payload_words = flash_page_bytes / 4 - flash_record_header_words;
+    constexpr uint32_t flash_data_chunks = (max_data_len + flash_record_payload_words - 1) / flash_record_payload_words;
+    // the most a checkpoint can take, everything dirty at once
+    constexpr uint32_t flash_checkpoint_pages = 2 + max_file_len + flash_data_chunks;
+    static_assert(2 * flash_checkpoint_pages + 2 * flash_pages_per_sector < flash_store_pages, "the log must hold two checkpoints");
+
+    // how long commands have to stop before anything is written, so an upload is written once at the end
+    constexpr uint32_t flash_store_idle_us = 250000;
+    // records written per flash_store_poll. core 0 is locked out for every erase and program, so a whole
+    // checkpoint (300 odd pages, over a second) goes out over that many core 1 loops instead of all at once
+    constexpr uint32_t flash_store_pages_per_poll = 4;
+
+    namespace FlashStore{
+        extern volatile uint32_t head; // sequence the next record gets
+        extern volatile uint32_t checkpoint; // sequence of the checkpoint boot would start from
+        extern volatile uint32_t pages_written;
+        extern volatile uint32_t sectors_erased;
+        extern volatile uint32_t load_us; // how long boot took to replay the log
+        extern volatile uint32_t poll_us; // longest flash_store_poll, about how long core 0 was held off
+    };
+
+    // the log region through XIP, and what erases and programs it. storage_device.cpp on the board,
+    // host/storage_file.cpp on the host. offsets are from the start of the log region
+    const uint8_t* flash_store_map();
+    bool flash_store_erase(uint32_t offset);
+    bool flash_store_program(uint32_t offset, const uint8_t* src);
+
+    // put back whatever was saved, false if there is nothing to put back
+    bool flash_store_load();
+    // something changed and wants saving
+    void flash_store_mark_config();
+    void flash_store_mark_file(uint8_t file_id);
+    void flash_store_mark_data(uint32_t index, uint32_t count);
+    // write out anything dirty once it has been left alone for flash_store_idle_us, flash_store_pages_per_poll
+    // records at a time. a checkpoint that has been started carries on at every poll until it is done
+    void flash_store_poll();
+    // write out anything dirty now, all of it
+    bool flash_store_flush();
+    // erase the whole log, nothing is put back on the next boot
+    void flash_store_format();
+    // forget the dirty marks and where the log is, for the host tests
+    void flash_store_reset();
+
+#endif // FLASH_STORE_H
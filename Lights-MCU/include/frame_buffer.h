@@ -0,0 +1,38 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+    #include <atomic>
+    #include <cstdint>
+    #include "constants.h"
+
+    /*
+        Ping-pong pair of LED frames. The DMA streams out the front one while core 1 renders
+        the next into the back one, then the frame timer IRQ just swaps them and re-arms the DMA.
+        back_ready hands the back buffer over: core 1 only writes it while false, the IRQ only
+        swaps while true, so there is never a copy and never both sides on the same buffer.
+    */
+    namespace FrameBuffer{
+        extern uint32_t buffers[2][max_led_len];
+        extern std::atomic<uint8_t> front;
+        extern std::atomic<bool> back_ready;
+
+        extern volatile uint32_t repeated; // ticks where the next frame wasn't rendered in time, while running
+        extern volatile uint32_t render_us; // how long the last render took on core 1
+    };
+
+    // core 1. render the next frame into the back buffer if it is free, through the output stage,
+    // and into ParallelOutput::wire
+    // alongside it when there is more than one strip. returns false if it was still waiting
+    bool render_pending_frame();
+
+    // frame timer IRQ. swap in the back buffer if it is ready and return the one the DMA should send,
+    // front is then the index into ParallelOutput::wire
+    uint32_t* frame_buffer_swap();
+
+    void frame_buffer_clear();
+
+    // output refreshes per frame of content. refreshes_per_frame under TEMPORAL dither, cut down so every
+    // refresh still has time to get the frame on the wire and latch it, 1 otherwise
+    uint8_t frame_refreshes();
+
+#endif // FRAME_BUFFER_H
@@ -0,0 +1,44 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+    #include <atomic>
+    #include <cstdint>
+    #include "constants.h"
+    #include "parsing.h"
+
+    // A complete request as it came off the wire, from the version byte through the CRC
+    struct Frame {
+        uint8_t buffer[frame_buffer_len];
+        ProtoError error; // anything that went wrong before it could be run, like BAD_CHECKSUM
+        uint32_t time_received; // time_us_32 when the end condition arrived
+        bool from_parser; // made by the parser, like a STREAM_ACK, rather than sent by the host
+    };
+
+    /*
+        Single producer (the parser on core 0) / single consumer (core 1) queue of frames.
+        Only head is written by the producer and only tail by the consumer, so all that is needed
+        is an acquire/release pair on each, no locks. Both count up forever and are masked to index.
+    */
+    namespace FrameQueue{
+        extern Frame slots[frame_queue_len];
+        extern std::atomic<uint32_t> head;
+        extern std::atomic<uint32_t> tail;
+
+        extern volatile uint32_t dropped; // frames thrown away because every slot was full
+        extern volatile uint32_t high_water; // most frames waiting at once
+    };
+
+    // producer side. the slot to parse the next frame into, or nullptr if the queue is full
+    Frame* frame_queue_write_slot();
+    // producer side. hand the frame from frame_queue_write_slot over to the consumer
+    void frame_queue_push();
+
+    // consumer side. the oldest frame, or nullptr if there is nothing waiting
+    Frame* frame_queue_peek();
+    // consumer side. release the frame from frame_queue_peek back to the producer
+    void frame_queue_pop();
+
+    uint32_t frame_queue_count();
+    void frame_queue_clear();
+
+#endif // FRAME_QUEUE_H
@@ -0,0 +1,82 @@
+#ifndef GAMMA_H
+#define GAMMA_H
+
+    #include <cstdint>
+
+    // gamma curves that can be picked per channel, ConfigIndex::gamma is 0xRRGGBB of these
+    enum class GammaCurve : uint8_t{
+        LINEAR = 0x00,
+        GAMMA_1_8 = 0x01,
+        GAMMA_2_0 = 0x02,
+        GAMMA_2_2 = 0x03,
+        GAMMA_2_5 = 0x04,
+        GAMMA_2_8 = 0x05,
+    };
+    constexpr uint8_t gamma_curve_count = 6;
+    constexpr double gamma_exponents[gamma_curve_count] = {1.0, 1.8, 2.0, 2.2, 2.5, 2.8};
+
+    // output is 8.8 fixed point so the fraction is still there for dithering, 255.0 at the top
+    constexpr uint16_t gamma_full_scale = 255 << 8;
+
+    // No pow() at compile time (or an FPU at run time), so just enough of ln and exp to build the tables.
+    // Only ever evaluated by the compiler
+    namespace GammaMath{
+        constexpr double ln(double x){
+            // x = m * 2^k with m in [0.5, 1), then ln(m) = 2 atanh((m-1)/(m+1))
+            int k = 0;
+            while (x < 0.5){ x *= 2; k--; }
+            while (x >= 1.0){ x /= 2; k++; }
+            double z = (x - 1) / (x + 1);
+            double term = z;
+            double sum = 0;
+            for (int n = 1; n < 40; n += 2){
+                sum += term / n;
+                term *= z * z;
+            }
+            return 2*sum + k * 0.69314718055994530942;
+        }
+
+        constexpr double exp(double y){
+            // halve it down to something the series handles, then square back up
+            int halvings = 0;
+            while (y < -0.5 or y > 0.5){ y /= 2; halvings++; }
+            double term = 1;
+            double sum = 1;
+            for (int n = 1; n < 20; n++){
+                term *= y / n;
+                sum += term;
+            }
+            while (halvings-- > 0){ sum *= sum; }
+            return sum;
+        }
+
+        constexpr double pow(double x, double exponent){
+            return x <= 0 ? 0 : exp(exponent * ln(x));
+        }
+    };
+
+    struct GammaTable {
+        uint16_t entries[256];
+    };
+
+    constexpr GammaTable make_gamma_table(double exponent){
+        GammaTable table = {};
+        for (int i = 0; i < 256; i++){
+            table.entries[i] = (uint16_t) (GammaMath::pow(i / 255.0, exponent) * gamma_full_scale + 0.5);
+        }
+        return table;
+    }
+
+    inline constexpr GammaTable gamma_tables[gamma_curve_count] = {
+        make_gamma_table(gamma_exponents[0]),
+        make_gamma_table(gamma_exponents[1]),
+        make_gamma_table(gamma_exponents[2]),
+        make_gamma_table(gamma_exponents[3]),
+        make_gamma_table(gamma_exponents[4]),
+        make_gamma_table(gamma_exponents[5]),
+    };
+
+    static_assert(gamma_tables[(uint8_t) GammaCurve::GAMMA_2_2].entries[255] == gamma_full_scale, "gamma table should end at full scale");
+    static_assert(gamma_tables[(uint8_t) GammaCurve::LINEAR].entries[128] == 128 << 8, "linear table should be the identity");
+
+#endif // GAMMA_H
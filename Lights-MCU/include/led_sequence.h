@@ -0,0 +1,58 @@
+#ifndef LED_SEQUENCE_H
+#define LED_SEQUENCE_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    // WS2811.pio sends one bit per us and the line sits low while its FIFO is empty
+    constexpr uint32_t ws2811_us_per_led = 24;
+    // low time the strip needs to latch a frame, WS2811 wants 50 us and newer parts up to 280 us
+    constexpr uint32_t ws2811_latch_us = 300;
+    // the gap between frames is counted out by a DMA pacing timer running one transfer per tick
+    constexpr uint32_t sequence_gap_tick_us = 10;
+    // a frame and a gap for every frame, and the null block on the end
+    constexpr uint32_t max_sequence_blocks = 2*max_frame_len + 1;
+
+    // one control block, the control channel copies it into the LED channel's alias 1 registers
+    // (CTRL, READ_ADDR, WRITE_ADDR, TRANS_COUNT_TRIG) and the count write starts it. frames and gaps
+    // each need their own DREQ, so CTRL can't just stay in the channel the way it does with alias 3.
+    // a block with a count of 0 is a null trigger and ends the chain, its CTRL still has IRQ_QUIET
+    // set so the null trigger is what raises the end IRQ
+    struct DmaControlBlock {
+        uint32_t ctrl;
+        const volatile void* read_addr;
+        volatile void* write_addr;
+        uint32_t transfer_count;
+    };
+
+    /*
+        Pre-rendered led_frame sequence, played out by DMA alone.
+        [frame 0][gap][frame 1][gap] ... [frame N-1][gap][null]
+        Each gap holds the line low long enough to latch and pads the frame out to its duration,
+        so the CPU is only involved at the IRQ the null block raises at the end of the sequence,
+        where led_sequence_end says whether to go round again.
+        A frame's duration is set with FRAME_DURATION, 0 leaves it at fps_ms.
+    */
+    namespace LedSequence{
+        extern DmaControlBlock blocks[max_sequence_blocks];
+        extern volatile uint16_t durations_ms[max_frame_len];
+        extern volatile bool running;
+        extern volatile uint32_t loops; // times the whole sequence has been played
+    };
+
+    // gap ticks after a frame of led_count LEDs, at least the latch time
+    uint32_t sequence_gap_ticks(uint16_t led_count, uint16_t fps_ms);
+
+    // how long frame is shown for, its own duration or fps_ms
+    uint16_t sequence_frame_ms(uint16_t frame, uint16_t fps_ms);
+
+    // fill LedSequence::blocks for the first frame_count frames of led_frame, each padded out to sequence_frame_ms.
+    // frame_ctrl / gap_ctrl are the CTRL values for the two kinds of block, both with IRQ_QUIET set and the null
+    // block keeps frame_ctrl. returns how many blocks, null included
+    uint32_t build_led_sequence(uint32_t frame_ctrl, uint32_t gap_ctrl, volatile void* pio_fifo,
+                                uint16_t frame_count, uint16_t led_count, uint16_t fps_ms);
+
+    // the end IRQ, counts the loop. true if the sequence is still meant to be running and wants building again
+    bool led_sequence_end();
+
+#endif // LED_SEQUENCE_H
@@ -15,6 +15,15 @@
 #define PIN_MOSI 19
 
 
+// PSRAM defines
+// An APS6404 for files too big for data[], on SPI 1 so it doesn't share a bus with the radio
+#define PSRAM_SPI  spi1
+#define PSRAM_SCK  10
+#define PSRAM_MOSI 11
+#define PSRAM_MISO 12
+#define PSRAM_CS   22
+
+
 // I2C defines
 // This example will use I2C0 on GPIO8 (SDA) and GPIO9 (SCL) running at 400KHz.
 // Pins can be changed, see the GPIO function select table in the datasheet for information on GPIO assignments
@@ -25,11 +34,22 @@
 // UART defines
 // By default the stdout UART is `uart0`, so we will use the second one
 #define UART_ID uart0
+// RX is drained from a DMA ring (setup_uart_rx_dma) rather than polled, so this can go up to 1-3 Mbaud
+// as long as the host side is changed to match
 #define BAUD_RATE 115200
 
 #define UART_TX_PIN 0
 #define UART_RX_PIN 1
 
+// WS2811 defines
+// a single string is on WS2811_PIN, with parallel output strip n is on WS2811_PIN + n.
+// only the strips up to SPI 0 on PIN_MISO have a pin on this board, strip_count can't be set past them
+#define WS2811_PIN 13
+#define WS2811_PARALLEL_PINS 3
+
+static_assert(WS2811_PIN + WS2811_PARALLEL_PINS <= PIN_MISO, "parallel strips would run into SPI 0");
+static_assert(PSRAM_MISO < WS2811_PIN, "parallel strips would run into the PSRAM");
+
 
 
 #endif
\ No newline at end of file
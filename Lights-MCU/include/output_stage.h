@@ -0,0 +1,60 @@
+#ifndef OUTPUT_STAGE_H
+#define OUTPUT_STAGE_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    // byte order sent down the wire, the frame itself is always rgb_to_int order
+    enum class ColorOrder : uint8_t{
+        RGB = 0x00,
+        GRB = 0x01,
+        BRG = 0x02,
+        RBG = 0x03,
+        GBR = 0x04,
+        BGR = 0x05,
+    };
+
+    enum class DitherMode : uint8_t{
+        OFF = 0x00,
+        ORDERED = 0x01, // fixed 8 step pattern, no state
+        TEMPORAL = 0x02, // error carried per LED from one refresh to the next, see temporal_dither_frame
+    };
+
+    /*
+        Last step before the frame goes out, run on core 1 after it is rendered.
+        The gamma curve (see gamma.h), global brightness and the per channel gain (0xRRGGBB) are folded
+        into a 256 entry table per channel, so a pixel is three lookups and a reorder. The tables are 8.8
+        fixed point, the fraction is rounded off or, with ORDERED dither, pushed up or down by a pattern
+        that changes every frame. On the RP2040 the interpolators do the shift, mask and table address
+        for each channel, with the same thing in plain C++ for the host.
+        Does nothing at all while everything is at its default.
+    */
+    namespace OutputStage{
+        extern uint16_t lut[3][256];
+        extern uint32_t frame_counter; // steps the dither pattern
+
+        // TEMPORAL dither. the rendered frame through the tables, kept at 8.8 across every refresh
+        // it is shown for, and what was rounded off last refresh for each LED and channel
+        extern uint16_t intermediate[max_led_len][3];
+        extern uint8_t carry[max_led_len][3];
+        extern volatile uint32_t dither_us; // how long the last temporal_dither_frame took
+    };
+
+    // rebuild the tables from light_config if brightness, channel_gain or gamma have changed
+    void update_output_luts();
+
+    void apply_output_stage(uint32_t* frame, uint32_t led_count);
+
+    /*
+        TEMPORAL dither, for when the output refreshes faster than the content changes (refreshes_per_frame).
+        Each new frame is run through the tables once into intermediate, then every refresh adds the
+        carried remainder, sends the top 8 bits and carries the bottom 8 to the next refresh, so the
+        average over the refreshes is the full 8.8 value. The per refresh work is one add per channel.
+    */
+    void load_temporal_frame(const uint32_t* frame, uint32_t led_count);
+    void temporal_dither_frame(uint32_t* frame, uint32_t led_count);
+    void clear_temporal_dither();
+    // the plain C++ path, what the interpolator path is checked against
+    void apply_output_stage_reference(uint32_t* frame, uint32_t led_count);
+
+#endif // OUTPUT_STAGE_H
@@ -0,0 +1,45 @@
+#ifndef PARALLEL_OUTPUT_H
+#define PARALLEL_OUTPUT_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    constexpr uint8_t max_strips = 8;
+    constexpr uint8_t ws2811_bits_per_led = 24;
+    // one byte per bit, one bit of that byte per strip
+    constexpr uint32_t parallel_words_per_led = ws2811_bits_per_led * max_strips / 32;
+
+    // which LEDs of the rendered frame a strip shows
+    struct Strip {
+        uint16_t start;
+        uint16_t led_count;
+    };
+
+    /*
+        Up to max_strips WS2811 strings driven at once by ws2811_parallel in WS2811.pio.
+        Every bit time the PIO shifts out one byte, bit s going to pin WS2811_PIN + s, so the
+        frame has to be transposed from a color per LED into a byte per bit first:
+        [LED 0 bit 23 of every strip][LED 0 bit 22] ... [LED 0 bit 0][LED 1 bit 23] ...
+        big end of each word first, same as the single strip colors.
+        Strips shorter than the longest are padded with black.
+        How many of them actually have a pin depends on the board, see WS2811_PARALLEL_PINS in light_hal.h.
+    */
+    namespace ParallelOutput{
+        extern Strip strips[max_strips];
+        // what the DMA sends, one per FrameBuffer buffer
+        extern uint32_t wire[2][max_led_len * parallel_words_per_led];
+    };
+
+    // split led_count LEDs evenly over the first strip_count strips
+    void layout_strips_evenly(uint8_t strip_count, uint16_t led_count);
+
+    // LEDs clocked out per strip, the longest of the first strip_count strips
+    uint16_t parallel_strip_len(uint8_t strip_count);
+
+    // transpose frame into wire for the first strip_count strips. returns the number of words written.
+    // three 8x8 bit transposes per LED done a word at a time (SWAR)
+    uint32_t transpose_strips(const uint32_t* frame, uint8_t strip_count, uint32_t* wire);
+    // the same a bit at a time, what transpose_strips is checked against
+    uint32_t transpose_strips_reference(const uint32_t* frame, uint8_t strip_count, uint32_t* wire);
+
+#endif // PARALLEL_OUTPUT_H
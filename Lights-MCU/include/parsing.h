@@ -44,6 +44,17 @@
         FILE_SET = 0x08,
         FILE_GET = 0x09,
         FILE_CLEAR = 0x0A,
+        BATCH = 0x0B,
+        STREAM_START = 0x0C,
+        STREAM_ACK = 0x0D,
+        STRIP_SET = 0x0E,
+        FILE_FORMAT = 0x0F, // [file id, FileFormat, palette file id], just [file id] gets back [format, palette file id]
+        EFFECT_SET = 0x10, // [file id, EffectId, params...], just [file id] gets back [effect, params...]
+        FRAME_DURATION = 0x11, // [frame id, ms] for a led_frame in the DMA sequence, 0 is fps_ms. just [frame id] gets it back
+        FILE_STORAGE = 0x12, // [file id, StorageKind], just [file id] gets back [storage, words it holds]
+        FILE_ALLOC = 0x13, // [file id, words] makes room in data[] for an SRAM file up front, gets back where it went
+        FILE_NEW = 0x14, // gets back a file id nothing is using
+        FILE_LIST = 0x15, // [first file id] up to file_list_page_len files in use from there, always a long binary reply (see send_file_list in comms.h)
     };
 
     enum class ParseState {
@@ -51,8 +62,11 @@
         READ_HEADER,
         READ_PAYLOAD,
         READ_CRC,
-        WAIT_FOR_PROCESSING,
-        WAIT_END
+        WAIT_END,
+        READ_STREAM_HEADER,
+        READ_STREAM_PAYLOAD,
+        READ_STREAM_CRC,
+        WAIT_STREAM_END
     };
 
     struct Command {
@@ -62,6 +76,7 @@
         // uint32_t param3;
         volatile uint32_t *payload;
         uint8_t payload_len;
+        bool from_parser; // queued by the parser itself, never by the host
     };
 
     enum class ConfigIndex : uint32_t{
@@ -75,7 +90,16 @@
         debug_b = 0x07,
         debug_cmd =0x08,
         status_report = 0x09,
-        current_file = 0x0A
+        current_file = 0x0A,
+        binary_reply = 0x0B,
+        dma_sequence = 0x0C,
+        strip_count = 0x0D,
+        brightness = 0x0E,
+        channel_gain = 0x0F,
+        color_order = 0x10,
+        gamma = 0x11,
+        dither = 0x12,
+        refreshes_per_frame = 0x13
     };
 
     struct Animation_Config {
@@ -89,7 +113,16 @@
         bool debug_cmd;
         bool status_report;
         uint8_t current_file;
-        
+        bool binary_reply; // reply with a binary frame instead of a JSON line
+        bool dma_sequence; // play led_frame[0..frame_count) by chained DMA instead of rendering files
+        uint8_t strip_count; // 1 is a single string on WS2811_PIN, more drives them in parallel, see parallel_output.h
+        uint8_t brightness; // applied in the output stage along with the rest below, see output_stage.h
+        uint32_t channel_gain; // 0xRRGGBB
+        uint8_t color_order; // ColorOrder
+        uint32_t gamma; // 0xRRGGBB of GammaCurve
+        uint8_t dither; // DitherMode
+        uint8_t refreshes_per_frame; // output refreshes for every frame of content, fps_ms is still the content rate. fewer if they don't fit, see frame_refreshes
+
     };
 
     struct Pio_SM_info{
@@ -110,17 +143,50 @@
 
         extern volatile ParseState uart_parsing_state;
     
-        extern volatile uint8_t uart_buffer[uart_buffer_len];
-        extern volatile uint8_t uart_working_index;
+        // the frame being parsed lives in a FrameQueue slot, see frame_queue.h
+        extern volatile uint16_t uart_working_index;
         extern volatile uint8_t payload_len;
         // extern volatile uint32_t time_last_byte_recvd;
         extern volatile uint32_t command_payload[64]; // len max is 256, so max is /4 of that
+        extern volatile uint16_t frame_crc; // running CRC of the header and payload bytes
+        extern volatile uint16_t received_crc;
+    };
+
+    /*
+        Streaming upload into data[], for files bigger than one frame can carry.
+        STREAM_START [file id, starting location, total words, window] opens it, wait for its reply, then send chunks.
+        starting location is ignored, the arena picks where the file goes
+        [1 B]           [2 B]       [2 B]           [N B]       [2 B]   [1 B]
+        [Stream Start]  [Sequence]  [Length]        [Payload]   [CRC]   [End]
+        Sequence counts up from 0, Length is in bytes and a multiple of 4, the payload is big endian words.
+        CRC is CRC-16/CCITT-FALSE over Sequence through Payload.
+
+        Words are written into data[] as they arrive, a chunk only counts once its CRC checks out.
+        A STREAM_ACK reply goes out every window chunks and on the last one, value is the next sequence expected.
+        A bad or out of order chunk gets a STREAM_ACK with the error straight away, the chunks after it are
+        dropped quietly until the expected sequence shows up again, so the host just goes back and resends from value.
+        Sending STREAM_ACK with no payload asks for the next sequence expected, for when a reply got lost,
+        one with a payload from the host is refused.
+        The file entry is only updated once every word is in, by the next STREAM_ACK run after that, so if
+        the last one was dropped with the queue full the empty STREAM_ACK the host times out into does it.
+    */
+    namespace Stream{
+        extern volatile bool active;
+        extern volatile uint8_t file_id;
+        extern volatile uint32_t start;
+        extern volatile uint32_t total; // words
+        extern volatile uint32_t cursor; // next data index to be written
+        extern volatile uint16_t expected_seq;
+        extern volatile uint16_t window;
+        extern volatile uint16_t chunks_since_ack;
+        extern volatile uint32_t generation; // goes up at every STREAM_START and every stop
+        extern volatile uint32_t finished; // generation of the stream the parser got every word of, not yet filled in
     };
 
 
 
     void process_byte(char b);
-    void parse_payload(JsonDocument& result, volatile uint8_t* data, uint8_t len);
+    void parse_payload(JsonDocument& result, volatile uint8_t* data, uint8_t len, bool from_parser = false);
 
     // template<typename T>
     void clear_uart_buffer(char* buff, uint16_t buff_len);
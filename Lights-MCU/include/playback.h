@@ -0,0 +1,54 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+    #include <cstdint>
+    #include "constants.h"
+    #include "files.h"
+    #include "file_table.h"
+    #include "parsing.h"
+
+    constexpr Animation_Config default_light_config = {250,100,2,0,0,0,1,0,1,0,0,0,1,0xFF,0xFFFFFF,0,0,0,1};
+
+    // Animation state shared between the command handlers and the frame timer
+    extern volatile Animation_Config light_config;
+
+    extern volatile uint8_t current_file;
+    extern volatile uint32_t playback_location;
+    // where within data[playback_location] to carry on from. the LED in the word for the packed FileFormats,
+    // frames into the fade for KEYFRAME
+    extern volatile uint16_t playback_slot;
+
+    /*
+        plain memory rather than volatile so the frame kernels can keep it in registers, nothing spins waiting on it.
+        The parser on core 0 writes stream chunks straight in while core 1 reads, moves and saves the rest, and
+        they never touch the same block at once. Each hand-off of a block is a fence pair so the plain stores
+        are all in before the other core goes near it:
+        - core 1 to the parser, stream_start releases before setting Stream::active, the parser acquires after seeing it
+        - the parser to core 1, the last chunk releases before clearing Stream::active (arena.cpp acquires after
+          seeing it) and the STREAM_ACK frame goes through the frame queue's release / acquire
+        - core 1 taking a block back early, stream_stop's fence with the parser's per word check
+        A flash checkpoint can still save a block half way through a stream, it is marked dirty and saved
+        again once the last chunk is in.
+    */
+    extern uint32_t data[max_data_len];
+
+    extern volatile uint32_t led_frame[max_frame_len][max_led_len];
+    extern volatile uint32_t working_frame_index;
+
+    uint32_t rgb_to_int(uint8_t red, uint8_t green, uint8_t blue);
+    // widen a 5:6:5 color to the same 24 bit layout as rgb_to_int, the low bits are filled from the high ones
+    uint32_t rgb565_to_int(uint16_t color);
+    // fade between two frame words by weight/256, the count byte of the result is 1
+    uint32_t lerp_color(uint32_t from, uint32_t to, uint32_t weight);
+
+    // setup a basic static color for file 0
+    void default_file_0();
+
+    // decode the data of the current file into frame, in whichever FileFormat it is, advancing playback_location.
+    // frame is max_led_len long, anything past that in led_count isn't rendered.
+    // each format has its own kernel, specialised at compile time and picked once a frame
+    void build_next_frame(uint32_t* frame);
+    // the original RLE decoder, what the RLE kernel is checked and benchmarked against
+    void build_rle_frame_reference(uint32_t* frame);
+
+#endif // PLAYBACK_H
@@ -0,0 +1,79 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+    #include <cstdint>
+    #include "constants.h"
+    #include "files.h"
+
+    // where each StorageKind lives on the board, in words
+    constexpr uint32_t storage_xip_offset = 1024 * 1024; // bytes into flash, the firmware has the first 1 MB
+    constexpr uint32_t storage_xip_words = (768 * 1024) / 4; // the last 256 KB is the flash store's log
+    constexpr uint32_t storage_psram_words = (8 * 1024 * 1024) / 4; // APS6404, 8 MB
+    constexpr uint32_t storage_psram_baud = 30 * 1000 * 1000;
+
+    /*
+        A place file words can be kept. Reads copy out into SRAM, start_read is the same but returns straight
+        away and read_done says when it has landed, one read in flight at a time.
+        write is nullptr for anything that can't be written at run time. XIP flash is written a sector at
+        a time and stalls both cores while it does, fine for an upload but not while something is playing.
+    */
+    struct StorageBackend{
+        const char* name;
+        uint32_t word_count;
+        bool (*read)(uint32_t index, uint32_t* dest, uint32_t count);
+        bool (*write)(uint32_t index, const uint32_t* src, uint32_t count);
+        bool (*start_read)(uint32_t index, uint32_t* dest, uint32_t count);
+        bool (*read_done)();
+    };
+
+    // SRAM is data[] itself, the others are in storage_device.cpp or the host stand-in
+    extern const StorageBackend sram_backend;
+    extern const StorageBackend xip_flash_backend;
+    extern const StorageBackend psram_backend;
+    const StorageBackend& storage_backend(StorageKind kind);
+    // claims the DMA channels, resets the PSRAM and readies core 0 for flash writes, firmware only
+    void setup_storage();
+
+    // copy words into the backend, false if it is out of range or the backend can't be written
+    bool storage_write(StorageKind kind, uint32_t index, const uint32_t* src, uint32_t count);
+
+    /*
+        Frames of a file outside SRAM are played out of a staging buffer, so the kernels in playback.cpp
+        still index one flat array. Every format touches at most prefetch_window_len words for a frame
+        (a whole KEYFRAME pair), so each buffer holds the first prefetch_window_len words of the file,
+        for going back round, then prefetch_window_len from the playback location:
+        [file start ...][playback location ...]
+        and start, end and location are rebased onto that. A file short enough is staged whole.
+        Once a frame is built the window for the next one is read into the other buffer in the background,
+        so by the time core 1 comes back for it the read has landed and nothing waits on slow memory.
+    */
+    constexpr uint32_t prefetch_window_len = 512;
+    static_assert(prefetch_window_len >= 2 * max_led_len + 2, "a KEYFRAME pair has to fit in the window");
+
+    struct StagedFrame{
+        const uint32_t* words; // stands in for data[], indexed by the rebased locations
+        uint32_t start;
+        uint32_t end;
+        uint32_t location;
+        uint32_t real_start; // where the rebasing maps back to
+        uint32_t real_location;
+        bool split; // head and window, rather than one run of the file
+    };
+
+    namespace Prefetch{
+        extern uint32_t stage[2][2 * prefetch_window_len];
+        extern volatile uint32_t hits; // frames whose window had already been read ahead
+        extern volatile uint32_t misses; // frames that had to wait for a read
+        extern volatile uint32_t generation; // bumped by every storage_write, so staged words are never stale
+    };
+
+    // the words a frame of file_id from location could need, in SRAM
+    StagedFrame stage_frame(StorageKind kind, uint8_t file_id, uint32_t start, uint32_t end, uint32_t location);
+    // a rebased location back to where it is in the backend
+    uint32_t unstage_location(const StagedFrame& staged, uint32_t location);
+    // start reading what a frame from location will need into the buffer stage_frame didn't just use
+    void prefetch_frame(StorageKind kind, uint8_t file_id, uint32_t start, uint32_t end, uint32_t location);
+    // forget everything staged, for start up and the host tests
+    void prefetch_clear();
+
+#endif // STORAGE_H
@@ -0,0 +1,22 @@
+#ifndef UART_RX_H
+#define UART_RX_H
+
+    #include <cstdint>
+    #include "constants.h"
+
+    namespace UartRx{
+        // DMA writes the hardware UART into this ring, it wraps on the address so it has to be aligned to its size
+        alignas(uart_rx_ring_len) extern volatile uint8_t ring[uart_rx_ring_len];
+        extern volatile uint32_t read_index;
+
+        extern volatile uint32_t bytes_received;
+        extern volatile uint32_t overrun_count; // number of drains that found the ring had lapped the reader
+        extern volatile uint32_t overrun_bytes; // bytes lost to those overruns
+        extern volatile uint32_t high_water; // most bytes waiting in the ring at a single drain
+    };
+
+    // feed the bytes_written bytes that have landed since the last drain through process_byte.
+    // returns how many bytes were parsed
+    uint32_t drain_rx_ring(uint32_t bytes_written);
+
+#endif // UART_RX_H
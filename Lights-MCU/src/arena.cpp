@@ -0,0 +1,247 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "arena.h"
+#include "parsing.h"
+#include "playback.h"
+#include "flash_store.h"
+
+
+namespace Arena{
+    volatile uint32_t moves = 0;
+    volatile uint32_t words_moved = 0;
+    volatile uint32_t free_words = max_data_len;
+    volatile uint32_t largest_free = max_data_len;
+};
+
+using namespace Arena;
+
+struct Block{
+    uint8_t file_id;
+    uint32_t start;
+    uint32_t len;
+};
+
+constexpr uint16_t no_file = max_file_len;
+constexpr uint32_t no_gap = UINT32_MAX;
+
+// too big for the core 1 stack with a full file table, everything here runs on core 1 so one will do
+static Block blocks[max_file_len];
+// nothing has been freed or moved since compaction last found nothing to do
+static bool compacted = false;
+
+
+// every block but exclude's into blocks, in data[] order
+static uint16_t sorted_blocks(uint16_t exclude){
+    uint16_t count = 0;
+    for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+        if (file_id == exclude or files.reserved[file_id] == 0){
+            continue;
+        }
+        Block block = {(uint8_t) file_id, files.start[file_id], files.reserved[file_id]};
+        // only run when something has changed, and compacted blocks are mostly in order already
+        uint16_t i = count++;
+        while (i > 0 and blocks[i - 1].start > block.start){
+            blocks[i] = blocks[i - 1];
+            i--;
+        }
+        blocks[i] = block;
+    }
+    return count;
+}
+
+static uint32_t find_gap(uint32_t words, uint16_t exclude){
+    uint16_t count = sorted_blocks(exclude);
+    uint32_t cursor = 0;
+    for (uint16_t i = 0; i < count; i++){
+        if (blocks[i].start > cursor and blocks[i].start - cursor >= words){
+            return cursor;
+        }
+        uint32_t end = blocks[i].start + blocks[i].len;
+        cursor = end > cursor ? end : cursor;
+    }
+    return cursor < max_data_len and max_data_len - cursor >= words ? cursor : no_gap;
+}
+
+// where the block after file_id's starts, or the end of data[]
+static uint32_t next_block_start(uint8_t file_id){
+    uint32_t start = files.start[file_id];
+    uint32_t next = max_data_len;
+    for (uint16_t other = 0; other < max_file_len; other++){
+        if (other != file_id and files.reserved[other] != 0 and files.start[other] > start and files.start[other] < next){
+            next = files.start[other];
+        }
+    }
+    return next;
+}
+
+static bool movable(uint8_t file_id){
+    // the parser on core 0 is writing straight into it
+    bool streaming = Stream::active and Stream::file_id == file_id;
+    // pairs with the release before the parser clears active, its last words are in before the move reads them
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return !streaming;
+}
+
+// the biggest gap compaction can make with exclude's block gone. a block being streamed into
+// can't move, so the blocks below it close up under it and the rest after it, two gaps rather than one
+static uint32_t largest_after_compact(uint16_t exclude){
+    uint16_t pinned = Stream::active ? Stream::file_id : no_file;
+    if (pinned == exclude or files.reserved[pinned % max_file_len] == 0){
+        pinned = no_file;
+    }
+    uint32_t pin_start = pinned != no_file ? files.start[pinned] : max_data_len;
+    uint32_t pin_end = pinned != no_file ? pin_start + files.reserved[pinned] : max_data_len;
+    uint32_t below = 0;
+    uint32_t above = 0;
+    for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+        if (file_id == exclude or file_id == pinned or files.reserved[file_id] == 0){
+            continue;
+        }
+        if (files.start[file_id] < pin_start){
+            below += files.reserved[file_id];
+        }
+        else{
+            above += files.reserved[file_id];
+        }
+    }
+    uint32_t low = pin_start > below ? pin_start - below : 0;
+    uint32_t high = max_data_len > pin_end + above ? max_data_len - pin_end - above : 0;
+    return low > high ? low : high;
+}
+
+static void move_block(uint8_t file_id, uint32_t to){
+    uint32_t from = files.start[file_id];
+    uint32_t len = files.reserved[file_id];
+    // the whole block, whatever the file has got up to in it
+    memmove(&data[to], &data[from], len * sizeof(uint32_t));
+    files.start[file_id] = to;
+    files.end[file_id] = files.end[file_id] >= from ? to + (files.end[file_id] - from) : to;
+    if (file_id == current_file){
+        playback_location = playback_location >= from ? to + (playback_location - from) : to;
+    }
+    flash_store_mark_file(file_id);
+    flash_store_mark_data(to, len);
+    moves = moves + 1;
+    words_moved = words_moved + len;
+    compacted = false;
+}
+
+bool arena_reserve(uint8_t file_id, uint32_t words){
+    if (files.reserved[file_id] >= words){
+        return true;
+    }
+    uint32_t gap = find_gap(words, file_id);
+    if (gap == no_gap){
+        if (largest_after_compact(file_id) < words){
+            return false;
+        }
+        // fits once the holes are closed up
+        arena_free(file_id);
+        arena_compact();
+        gap = find_gap(words, no_file);
+        if (gap == no_gap){
+            // largest_after_compact said otherwise, the file is left with no block rather than one off the end
+            return false;
+        }
+    }
+    files.start[file_id] = gap;
+    files.reserved[file_id] = words;
+    compacted = false;
+    return true;
+}
+
+bool arena_grow(uint8_t file_id, uint32_t words){
+    if (files.reserved[file_id] == 0){
+        return arena_reserve(file_id, words);
+    }
+    for (int attempt = 0; attempt < 2; attempt++){
+        if (files.reserved[file_id] >= words){
+            return true;
+        }
+        // nothing straight after it, it can just get longer
+        if (next_block_start(file_id) - files.start[file_id] >= words){
+            files.reserved[file_id] = words;
+            compacted = false;
+            return true;
+        }
+        uint32_t gap = find_gap(words, file_id);
+        if (gap != no_gap){
+            move_block(file_id, gap);
+            files.reserved[file_id] = words;
+            return true;
+        }
+        if (attempt == 0){
+            arena_compact();
+        }
+    }
+    return false;
+}
+
+void arena_free(uint8_t file_id){
+    if (files.reserved[file_id] != 0){
+        files.reserved[file_id] = 0;
+        compacted = false;
+    }
+}
+
+bool arena_compact_step(){
+    if (compacted){
+        return false;
+    }
+    uint16_t count = sorted_blocks(no_file);
+    uint32_t cursor = 0;
+    bool stuck = false;
+    for (uint16_t i = 0; i < count; i++){
+        if (blocks[i].start > cursor){
+            if (movable(blocks[i].file_id)){
+                move_block(blocks[i].file_id, cursor);
+                return true;
+            }
+            stuck = true;
+        }
+        uint32_t end = blocks[i].start + blocks[i].len;
+        cursor = end > cursor ? end : cursor;
+    }
+    // a block being streamed into has to be looked at again once the stream is done
+    compacted = !stuck;
+    free_words = arena_free_words();
+    largest_free = arena_largest_free();
+    return false;
+}
+
+void arena_compact(){
+    while (arena_compact_step()){
+    }
+}
+
+void arena_reset(){
+    compacted = false;
+    moves = 0;
+    words_moved = 0;
+    free_words = max_data_len;
+    largest_free = max_data_len;
+}
+
+uint32_t arena_free_words(){
+    uint32_t used = 0;
+    for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+        used += files.reserved[file_id];
+    }
+    return used < max_data_len ? max_data_len - used : 0;
+}
+
+uint32_t arena_largest_free(){
+    uint16_t count = sorted_blocks(no_file);
+    uint32_t cursor = 0;
+    uint32_t largest = 0;
+    for (uint16_t i = 0; i < count; i++){
+        if (blocks[i].start > cursor and blocks[i].start - cursor > largest){
+            largest = blocks[i].start - cursor;
+        }
+        uint32_t end = blocks[i].start + blocks[i].len;
+        cursor = end > cursor ? end : cursor;
+    }
+    return max_data_len - cursor > largest ? max_data_len - cursor : largest;
+}
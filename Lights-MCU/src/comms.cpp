@@ -0,0 +1,217 @@
+#include <cstdint>
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "pico/mutex.h"
+#include "pico/time.h"
+#include "hardware/uart.h"
+
+#include "comms.h"
+#include "crc16.h"
+#include "frame_queue.h"
+#include "parsing.h"
+#include "playback.h"
+#include "file_table.h"
+#include "light_hal.h"
+
+
+mutex_t uart_mutex;
+volatile uint32_t time_last_byte_recvd;
+
+char uart_buff[250];
+JsonDocument status;
+
+
+void output_byte(uint8_t b) {
+    // uart_putc_raw(uart0, b);  // hardware UART Only
+    putchar_raw(b);           // Both UART AND USB
+}
+
+void uart_out(char* buffer, int buffer_len){
+    mutex_enter_blocking(&uart_mutex);
+    for(int i=0; i< buffer_len; i++){
+        if (buffer[i] == 0){ // NULL ending
+            mutex_exit(&uart_mutex);
+            return;
+        }
+        output_byte(buffer[i]);
+    }
+    // output_byte(0); // NULL ending
+    mutex_exit(&uart_mutex);
+}
+
+void uart_write(const uint8_t* buffer, int buffer_len){
+    mutex_enter_blocking(&uart_mutex);
+    for(int i=0; i< buffer_len; i++){
+        output_byte(buffer[i]);
+    }
+    mutex_exit(&uart_mutex);
+}
+
+static uint8_t put_word(uint8_t* buffer, uint8_t index, uint32_t value){
+    buffer[index++] = (value >> 24) & 0xFF;
+    buffer[index++] = (value >> 16) & 0xFF;
+    buffer[index++] = (value >> 8) & 0xFF;
+    buffer[index++] = value & 0xFF;
+    return index;
+}
+
+uint8_t serialize_binary_reply(JsonDocument& result, uint8_t cmd_id, uint8_t* buffer, uint8_t buffer_len){
+    JsonVariant value = result["value"];
+    uint32_t value_count = value.is<JsonArray>() ? value.size() : 1;
+    uint8_t error = result["error"].as<uint8_t>();
+    if (HEADER_LEN + 2 + 1 + 4*value_count + CRC_LEN > buffer_len){
+        // too many values to fit, the host still gets an answer, just the error and nothing else
+        value_count = 0;
+        error = (uint8_t) ProtoError::OUT_OF_RANGE;
+        if (HEADER_LEN + 2 + 1 + CRC_LEN > buffer_len){
+            return 0;
+        }
+    }
+
+    uint8_t index = 0;
+    buffer[index++] = START_CONDITION;
+    buffer[index++] = 0x01; // version
+    buffer[index++] = cmd_id;
+    buffer[index++] = 1 + 4*value_count; // error + values
+    buffer[index++] = error;
+    if (value_count > 0){
+        if (value.is<JsonArray>()){
+            for (JsonVariant item : value.as<JsonArray>()){
+                index = put_word(buffer, index, item.as<uint32_t>());
+            }
+        }
+        else{
+            index = put_word(buffer, index, value.as<uint32_t>());
+        }
+    }
+    // CRC covers Version through the values, same as the requests
+    uint16_t crc = crc16(&buffer[1], index - 1);
+    buffer[index++] = (crc >> 8) & 0xFF;
+    buffer[index++] = crc & 0xFF;
+    buffer[index++] = END_CONDITION;
+    return index;
+}
+
+// one byte out and into the CRC
+static void output_crc_byte(uint16_t& crc, uint8_t b){
+    crc = crc16_update(crc, b);
+    output_byte(b);
+}
+
+void send_file_list(uint16_t first){
+    // the page is worked out first, Payload Length goes out ahead of it
+    uint16_t count = 0;
+    uint16_t next = first;
+    for (; next < max_file_len and count < file_list_page_len; next++){
+        count += file_table_in_use(next) ? 1 : 0;
+    }
+    // nothing left after the last one on the page, the host doesn't need to ask again
+    uint16_t rest = next;
+    while (rest < max_file_len and !file_table_in_use(rest)){
+        rest++;
+    }
+    next = rest;
+
+    uint16_t reply_len = 1 + 4 + 12*count;
+    mutex_enter_blocking(&uart_mutex);
+    output_byte(STREAM_START_CONDITION);
+    uint16_t crc = CRC16_INIT;
+    output_crc_byte(crc, 0x01); // version
+    output_crc_byte(crc, (uint8_t) CommandState::FILE_LIST);
+    output_crc_byte(crc, (reply_len >> 8) & 0xFF);
+    output_crc_byte(crc, reply_len & 0xFF);
+    output_crc_byte(crc, (uint8_t) ProtoError::OK);
+    uint8_t next_word[4];
+    put_word(next_word, 0, next);
+    for (uint8_t b : next_word){
+        output_crc_byte(crc, b);
+    }
+    for (uint16_t file_id = first; file_id < max_file_len and count > 0; file_id++){
+        if (!file_table_in_use(file_id)){
+            continue;
+        }
+        count--;
+        uint8_t entry[12];
+        put_word(entry, 0, (file_id << 24) | ((uint8_t) files.action[file_id] << 16)
+            | ((uint8_t) files.format[file_id] << 8) | (uint8_t) files.storage[file_id]);
+        put_word(entry, 4, files.start[file_id]);
+        put_word(entry, 8, files.end[file_id]);
+        for (uint8_t b : entry){
+            output_crc_byte(crc, b);
+        }
+    }
+    output_byte((crc >> 8) & 0xFF);
+    output_byte(crc & 0xFF);
+    output_byte(END_CONDITION);
+    mutex_exit(&uart_mutex);
+}
+
+bool handle_pending_command(JsonDocument& result){
+    Frame* frame = frame_queue_peek();
+    if (frame == nullptr){
+        return false;
+    }
+    uint8_t cmd_id = frame->buffer[1];
+    uint8_t payload_len = frame->buffer[2];
+    uint32_t time_received = frame->time_received;
+
+    if(light_config.debug_cmd){
+        sprintf(uart_buff, "VER: %02x, CMD: %02x, LEN: %02x, PLD: [",
+                frame->buffer[0], // ver
+                frame->buffer[1], // cmd
+                frame->buffer[2] // len
+            );
+
+        for (int i = 0;i<payload_len; i++){
+            sprintf(uart_buff, "%s %2X",
+                uart_buff,
+                frame->buffer[3+i]
+            );
+        }
+        sprintf(uart_buff, "%s] \n",
+            uart_buff
+        );
+        mutex_enter_blocking(&uart_mutex);
+        uart_puts(UART_ID, uart_buff);
+        mutex_exit(&uart_mutex);
+    }
+
+    uint32_t timing = time_us_32();
+    result.clear();
+    status["Timing"]["result_clear"] = time_us_32()-timing;
+    // Total processing time for a FILE::GET is about 155 us
+    timing = time_us_32();
+    if (frame->error != ProtoError::OK){
+        // the frame never made it through the parser intact, so dont run any of it
+        result["value"] = cmd_id;
+        result["error"] = (uint8_t) frame->error;
+    }
+    else{
+        parse_payload(result, frame->buffer, payload_len, frame->from_parser);
+    }
+    // everything needed from the frame has been copied out, let the parser have the slot back
+    frame_queue_pop();
+
+    status["Timing"]["e2e"] = time_us_32()-time_received;
+    status["Timing"]["parse"] = time_us_32()-timing;
+
+    // format the results for sending back
+    if ((CommandState) cmd_id == CommandState::FILE_LIST and result["error"].as<uint8_t>() == (uint8_t) ProtoError::OK){
+        // value is the first file id asked for
+        send_file_list(result["value"].as<uint16_t>());
+    }
+    else if (light_config.binary_reply){
+        uint8_t* reply = (uint8_t*) uart_buff;
+        auto length = serialize_binary_reply(result, cmd_id, reply, sizeof(uart_buff));
+        uart_write(reply, length);
+    }
+    else{
+        auto length = serializeJson(result, uart_buff);
+        uart_buff[length] = '\n';
+
+        uart_out(uart_buff, 250);
+        clear_uart_buffer(uart_buff, 250);
+    }
+
+    return true;
+}
@@ -0,0 +1,150 @@
+#include <cstdint>
+#include "pico/time.h"
+
+#include "effects.h"
+#include "playback.h"
+
+
+namespace Effects{
+    EffectSettings settings[max_file_len] = {};
+    volatile uint32_t render_us[effect_count] = {0};
+};
+
+using namespace Effects;
+
+// FIRE is the only effect that remembers anything between frames
+static uint8_t heat[max_led_len] = {0};
+static uint32_t random_state = 0x2545F491;
+
+
+static uint32_t random_next(){
+    // xorshift32, plenty for flickering
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static uint32_t scale_color(uint32_t color, uint32_t level){
+    // level is 0-256, red and blue share a multiply the same as lerp_color
+    uint32_t red_blue = (((color & 0xFF00FF) * level) >> 8) & 0xFF00FF;
+    uint32_t green = (((color & 0x00FF00) * level) >> 8) & 0x00FF00;
+    return red_blue | green;
+}
+
+// 0 up to 255 and back down over 512 steps
+static uint32_t triangle(uint32_t x){
+    x &= 0x1FF;
+    return x < 256 ? x : 511 - x;
+}
+
+uint32_t hue_to_int(uint8_t hue){
+    if (hue < 85){
+        return rgb_to_int(255 - hue * 3, hue * 3, 0);
+    }
+    if (hue < 170){
+        hue -= 85;
+        return rgb_to_int(0, 255 - hue * 3, hue * 3);
+    }
+    hue -= 170;
+    return rgb_to_int(hue * 3, 0, 255 - hue * 3);
+}
+
+static void render_rainbow(uint32_t* frame, uint16_t led_count, uint32_t time, const EffectSettings& settings){
+    // hue kept in 8.8 so there's no divide per LED
+    uint32_t hue = ((time * settings.params[0]) >> 8) << 8;
+    uint32_t step = (settings.params[1] << 8) / led_count;
+    for (uint16_t i = 0; i < led_count; i++){
+        frame[i] = (hue_to_int(hue >> 8) << 8) | 1;
+        hue += step;
+    }
+}
+
+static void render_chase(uint32_t* frame, uint16_t led_count, uint32_t time, const EffectSettings& settings){
+    uint32_t head = ((time * settings.params[0]) >> 8) % led_count;
+    uint32_t color = (settings.params[1] << 8) | 1;
+    uint32_t width = settings.params[2] ? settings.params[2] : 1;
+    // how far behind the head each LED is, wrapping round the end of the strip
+    uint32_t behind = head;
+    for (uint16_t i = 0; i < led_count; i++){
+        frame[i] = behind < width ? color : 1;
+        behind = behind == 0 ? led_count - 1 : behind - 1;
+    }
+}
+
+static void render_twinkle(uint32_t* frame, uint16_t led_count, uint32_t time, const EffectSettings& settings){
+    uint32_t phase = (time * settings.params[0]) >> 8;
+    uint32_t density = settings.params[2];
+    for (uint16_t i = 0; i < led_count; i++){
+        // each LED gets its own fixed start point in the wave, and only some of them twinkle at all
+        uint32_t hash = (i + 1) * 2654435761u;
+        if (((hash >> 8) & 0xFF) >= density){
+            frame[i] = 1;
+            continue;
+        }
+        uint32_t level = triangle(phase + (hash >> 23));
+        frame[i] = (scale_color(settings.params[1], (level * level) >> 8) << 8) | 1;
+    }
+}
+
+static void render_fire(uint32_t* frame, uint16_t led_count, uint32_t /* time */, const EffectSettings& settings){
+    // heat rises up the strip from LED 0, cooling as it goes, with new sparks near the bottom
+    uint32_t cooling = (settings.params[0] * 10) / led_count + 2;
+    for (uint16_t i = 0; i < led_count; i++){
+        uint32_t cool = random_next() % cooling;
+        heat[i] = heat[i] > cool ? heat[i] - cool : 0;
+    }
+    for (uint16_t i = led_count - 1; i >= 2; i--){
+        heat[i] = (heat[i - 1] + 2 * heat[i - 2]) / 3;
+    }
+    if ((random_next() & 0xFF) < settings.params[1]){
+        uint16_t spark = random_next() % (led_count < 7 ? led_count : 7);
+        uint32_t hotter = heat[spark] + 160 + random_next() % 96;
+        heat[spark] = hotter > 255 ? 255 : hotter;
+    }
+
+    for (uint16_t i = 0; i < led_count; i++){
+        // black to red to yellow to white
+        uint32_t scaled = (heat[i] * 191) / 255;
+        uint8_t ramp = (scaled & 0x3F) << 2;
+        uint32_t color;
+        if (scaled & 0x80){
+            color = rgb_to_int(255, 255, ramp);
+        }
+        else if (scaled & 0x40){
+            color = rgb_to_int(255, ramp, 0);
+        }
+        else{
+            color = rgb_to_int(ramp, 0, 0);
+        }
+        frame[i] = (color << 8) | 1;
+    }
+}
+
+static void render_breathing(uint32_t* frame, uint16_t led_count, uint32_t time, const EffectSettings& settings){
+    // squared so it spends longer near off, where the eye can see the steps
+    uint32_t level = triangle((time * settings.params[0]) >> 8);
+    uint32_t color = (scale_color(settings.params[1], (level * level) >> 8) << 8) | 1;
+    for (uint16_t i = 0; i < led_count; i++){
+        frame[i] = color;
+    }
+}
+
+const Effect effect_registry[effect_count] = {
+    {"rainbow", render_rainbow},
+    {"chase", render_chase},
+    {"twinkle", render_twinkle},
+    {"fire", render_fire},
+    {"breathing", render_breathing},
+};
+
+void render_effect(uint8_t file_id, uint32_t* frame, uint16_t led_count, uint32_t time){
+    if (led_count == 0){
+        return;
+    }
+    uint32_t timing = time_us_32();
+    const EffectSettings& effect = settings[file_id];
+    uint8_t id = (uint8_t) effect.id < effect_count ? (uint8_t) effect.id : 0;
+    effect_registry[id].render(frame, led_count, time, effect);
+    render_us[id] = time_us_32() - timing;
+}
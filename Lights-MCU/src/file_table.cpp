@@ -0,0 +1,94 @@
+#include <cstdint>
+
+#include "file_table.h"
+
+
+volatile FileTable files;
+
+// a stack of the free ids, with where each one is in it so any id can come off in one go
+static uint8_t free_ids[max_file_len];
+static uint16_t free_slot[max_file_len];
+static uint16_t free_count = 0;
+constexpr uint16_t not_free = max_file_len;
+
+
+static void file_entry_clear(uint8_t file_id){
+    files.start[file_id] = 0;
+    files.end[file_id] = 0;
+    files.action[file_id] = EndAction::REPEAT;
+    files.format[file_id] = FileFormat::RLE;
+    files.storage[file_id] = StorageKind::SRAM;
+    files.palette[file_id] = 0;
+    files.reserved[file_id] = 0;
+}
+
+void file_table_clear(){
+    free_count = 0;
+    // highest first, so the lowest free id is the next one handed out
+    for (uint16_t i = max_file_len; i > 0; i--){
+        uint8_t file_id = (uint8_t) (i - 1);
+        file_entry_clear(file_id);
+        free_slot[file_id] = free_count;
+        free_ids[free_count++] = file_id;
+    }
+}
+
+void file_table_use(uint8_t file_id){
+    uint16_t slot = free_slot[file_id];
+    if (slot == not_free){
+        return;
+    }
+    // the top of the stack fills the gap
+    uint8_t top = free_ids[--free_count];
+    free_ids[slot] = top;
+    free_slot[top] = slot;
+    free_slot[file_id] = not_free;
+}
+
+void file_table_release(uint8_t file_id){
+    file_entry_clear(file_id);
+    if (free_slot[file_id] != not_free){
+        return;
+    }
+    free_slot[file_id] = free_count;
+    free_ids[free_count++] = file_id;
+}
+
+bool file_table_new(uint8_t& file_id){
+    if (free_count == 0){
+        return false;
+    }
+    file_id = free_ids[free_count - 1];
+    file_table_use(file_id);
+    return true;
+}
+
+bool file_table_in_use(uint8_t file_id){
+    return free_slot[file_id] == not_free;
+}
+
+uint16_t file_table_count(){
+    return max_file_len - free_count;
+}
+
+File file_entry(uint8_t file_id){
+    return {
+        files.start[file_id],
+        files.end[file_id],
+        files.action[file_id],
+        files.format[file_id],
+        files.palette[file_id],
+        files.storage[file_id],
+        files.reserved[file_id],
+    };
+}
+
+void set_file_entry(uint8_t file_id, const File& file){
+    files.start[file_id] = file.start;
+    files.end[file_id] = file.end;
+    files.action[file_id] = file.action;
+    files.format[file_id] = file.format;
+    files.palette[file_id] = file.palette;
+    files.storage[file_id] = file.storage;
+    files.reserved[file_id] = file.reserved;
+}
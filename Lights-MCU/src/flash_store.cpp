@@ -0,0 +1,483 @@
+#include <cstdint>
+#include <cstring>
+#include "pico/time.h"
+
+#include "flash_store.h"
+#include "storage.h"
+#include "playback.h"
+#include "effects.h"
+#include "parallel_output.h"
+#include "light_hal.h"
+#include "crc16.h"
+
+
+namespace FlashStore{
+    volatile uint32_t head = 0;
+    volatile uint32_t checkpoint = 0;
+    volatile uint32_t pages_written = 0;
+    volatile uint32_t sectors_erased = 0;
+    volatile uint32_t load_us = 0;
+    volatile uint32_t poll_us = 0;
+};
+
+using namespace FlashStore;
+
+static_assert(storage_xip_offset + storage_xip_words * 4 <= flash_store_offset, "XIP_FLASH files run into the log");
+static_assert(sizeof(Animation_Config) + 1 <= flash_record_payload_words * 4, "a CONFIG record is one page");
+static_assert(sizeof(File) + sizeof(EffectSettings) <= flash_record_payload_words * 4, "a FILE record is one page");
+// these go in as they are in memory, so a change to any of them needs flash_record_layout bumped
+static_assert(sizeof(Animation_Config) == 36 and sizeof(File) == 20 and sizeof(EffectSettings) == 16, "bump flash_record_layout");
+
+constexpr uint32_t config_record_words = (sizeof(Animation_Config) + 1 + 3) / 4;
+constexpr uint32_t file_record_words = (sizeof(File) + sizeof(EffectSettings) + 3) / 4;
+
+static bool scanned = false;
+static bool has_checkpoint = false;
+// a checkpoint newer than the one boot used never finished, anything written after it can't be reached
+static bool torn = false;
+static bool any_dirty = false;
+static bool config_dirty = false;
+static bool file_dirty[max_file_len] = {false};
+static bool data_dirty[flash_data_chunks] = {false};
+static uint32_t last_change = 0;
+
+
+static uint32_t round_to_sector(uint32_t sequence){
+    return (sequence + flash_pages_per_sector - 1) / flash_pages_per_sector * flash_pages_per_sector;
+}
+
+static const uint32_t* page_at(uint32_t sequence){
+    return (const uint32_t*) (flash_store_map() + (sequence % flash_store_pages) * flash_page_bytes);
+}
+
+// everything but the magic and the CRC itself
+static uint16_t record_crc(const uint32_t* page){
+    const uint8_t* bytes = (const uint8_t*) page;
+    uint16_t crc = CRC16_INIT;
+    for (uint32_t i = 4; i < 16; i++){
+        crc = crc16_update(crc, bytes[i]);
+    }
+    for (uint32_t i = flash_record_header_words * 4; i < flash_page_bytes; i++){
+        crc = crc16_update(crc, bytes[i]);
+    }
+    return crc;
+}
+
+static bool page_valid(uint32_t sequence){
+    const uint32_t* page = page_at(sequence);
+    return page[0] == flash_record_magic and page[1] == sequence and page[4] == record_crc(page);
+}
+
+static bool checkpoint_complete(uint32_t sequence){
+    uint32_t pages = page_at(sequence)[3];
+    if (pages == 0 or pages > flash_checkpoint_pages){
+        return false;
+    }
+    for (uint32_t i = 0; i < pages; i++){
+        if (!page_valid(sequence + i)){
+            return false;
+        }
+    }
+    return true;
+}
+
+// find the end of the log and the checkpoint to start from, only the headers are read
+static void scan(){
+    bool any = false;
+    uint32_t newest = 0;
+    // the two newest checkpoints, in case the newest never finished
+    bool found[2] = {false, false};
+    uint32_t checkpoints[2] = {0, 0};
+    for (uint32_t position = 0; position < flash_store_pages; position++){
+        const uint32_t* page = (const uint32_t*) (flash_store_map() + position * flash_page_bytes);
+        if (page[0] != flash_record_magic or page[1] % flash_store_pages != position){
+            continue;
+        }
+        uint32_t sequence = page[1];
+        if (!any or sequence > newest){
+            newest = sequence;
+            any = true;
+        }
+        if ((FlashRecord) (page[2] >> 24) == FlashRecord::CHECKPOINT){
+            if (!found[0] or sequence > checkpoints[0]){
+                checkpoints[1] = checkpoints[0];
+                found[1] = found[0];
+                checkpoints[0] = sequence;
+                found[0] = true;
+            }
+            else if (!found[1] or sequence > checkpoints[1]){
+                checkpoints[1] = sequence;
+                found[1] = true;
+            }
+        }
+    }
+
+    // whatever sector the last boot stopped in may have a half written page, start on a fresh one
+    head = any ? round_to_sector(newest + 1) : 0;
+    has_checkpoint = false;
+    for (uint8_t i = 0; i < 2 and !has_checkpoint; i++){
+        if (found[i] and checkpoint_complete(checkpoints[i])){
+            checkpoint = checkpoints[i];
+            has_checkpoint = true;
+        }
+    }
+    torn = found[0] and (!has_checkpoint or checkpoint != checkpoints[0]);
+    scanned = true;
+}
+
+static void apply(const uint32_t* page){
+    FlashRecord type = (FlashRecord) (page[2] >> 24);
+    uint8_t id = (page[2] >> 16) & 0xFF;
+    uint8_t layout = (page[2] >> 8) & 0xFF;
+    uint32_t count = page[2] & 0xFF;
+    // written by firmware with the structs laid out some other way, better to keep what is there than copy it in
+    bool current = layout == flash_record_layout;
+    uint32_t index = page[3];
+    const uint8_t* payload = (const uint8_t*) &page[flash_record_header_words];
+    switch (type){
+        case FlashRecord::CHECKPOINT:
+            // a checkpoint has everything, anything it leaves out is empty
+            memset(data, 0, sizeof(data));
+            file_table_clear();
+            break;
+        case FlashRecord::CONFIG:
+            if (!current or count != config_record_words){
+                break;
+            }
+            memcpy((void*) &light_config, payload, sizeof(Animation_Config));
+            current_file = payload[sizeof(Animation_Config)];
+            break;
+        case FlashRecord::FILE:
+            if (index == 1){
+                file_table_release(id);
+                Effects::settings[id] = {};
+                break;
+            }
+            if (!current or count != file_record_words){
+                break;
+            }
+            File file;
+            memcpy(&file, payload, sizeof(File));
+            set_file_entry(id, file);
+            memcpy(&Effects::settings[id], payload + sizeof(File), sizeof(EffectSettings));
+            file_table_use(id);
+            break;
+        case FlashRecord::DATA:
+            if (index + count <= max_data_len and count <= flash_record_payload_words){
+                memcpy(&data[index], payload, count * sizeof(uint32_t));
+            }
+            break;
+    }
+}
+
+bool flash_store_load(){
+    uint32_t timing = time_us_32();
+    scan();
+    if (!has_checkpoint){
+        return false;
+    }
+    // straight out of XIP, nothing is copied but the records themselves
+    uint32_t sequence = checkpoint;
+    while (sequence < head){
+        if (page_valid(sequence)){
+            const uint32_t* page = page_at(sequence);
+            if ((FlashRecord) (page[2] >> 24) == FlashRecord::CHECKPOINT and sequence != checkpoint){
+                // the unfinished one scan skipped over
+                break;
+            }
+            apply(page);
+            sequence++;
+            continue;
+        }
+        // a boot after this one carried on from the next sector
+        uint32_t next = round_to_sector(sequence + 1);
+        if (sequence % flash_pages_per_sector == 0 or !page_valid(next)){
+            break;
+        }
+        sequence = next;
+    }
+
+    playback_location = files.start[current_file];
+    playback_slot = 0;
+    // the strip layout and led_frame aren't saved, the strips are split evenly again and the
+    // sequence would only play blank frames
+    if (light_config.strip_count == 0 or light_config.strip_count > max_strips or light_config.strip_count > WS2811_PARALLEL_PINS){
+        light_config.strip_count = 1;
+    }
+    layout_strips_evenly(light_config.strip_count, light_config.led_count);
+    light_config.dma_sequence = false;
+    load_us = time_us_32() - timing;
+    return true;
+}
+
+static bool write_record(FlashRecord type, uint8_t id, uint32_t index, const void* payload, uint32_t bytes){
+    uint32_t page[flash_page_bytes / 4] = {0};
+    page[0] = flash_record_magic;
+    page[1] = head;
+    page[2] = ((uint32_t) type << 24) | ((uint32_t) id << 16) | ((uint32_t) flash_record_layout << 8) | (bytes / 4);
+    page[3] = index;
+    if (bytes){
+        memcpy(&page[flash_record_header_words], payload, bytes);
+    }
+    page[4] = record_crc(page);
+
+    uint32_t position = head % flash_store_pages;
+    if (position % flash_pages_per_sector == 0){
+        if (!flash_store_erase(position * flash_page_bytes)){
+            return false;
+        }
+        sectors_erased = sectors_erased + 1;
+    }
+    if (!flash_store_program(position * flash_page_bytes, (const uint8_t*) page)){
+        return false;
+    }
+    head = head + 1;
+    pages_written = pages_written + 1;
+    return true;
+}
+
+static bool write_config(){
+    uint8_t payload[sizeof(Animation_Config) + 1];
+    memcpy(payload, (const void*) &light_config, sizeof(Animation_Config));
+    payload[sizeof(Animation_Config)] = current_file;
+    // rounded up to whole words, the rest of the page is zero anyway
+    return write_record(FlashRecord::CONFIG, 0, 0, payload, (sizeof(payload) + 3) & ~3u);
+}
+
+static bool write_file(uint8_t file_id){
+    if (!file_table_in_use(file_id)){
+        return write_record(FlashRecord::FILE, file_id, 1, nullptr, 0);
+    }
+    uint8_t payload[sizeof(File) + sizeof(EffectSettings)];
+    File file = file_entry(file_id);
+    memcpy(payload, &file, sizeof(File));
+    memcpy(payload + sizeof(File), &Effects::settings[file_id], sizeof(EffectSettings));
+    return write_record(FlashRecord::FILE, file_id, 0, payload, (sizeof(payload) + 3) & ~3u);
+}
+
+static bool write_data(uint32_t chunk){
+    uint32_t index = chunk * flash_record_payload_words;
+    uint32_t count = max_data_len - index < flash_record_payload_words ? max_data_len - index : flash_record_payload_words;
+    return write_record(FlashRecord::DATA, 0, index, &data[index], count * sizeof(uint32_t));
+}
+
+static bool chunk_empty(uint32_t chunk){
+    uint32_t index = chunk * flash_record_payload_words;
+    for (uint32_t i = index; i < index + flash_record_payload_words and i < max_data_len; i++){
+        if (data[i] != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void clear_dirty(){
+    any_dirty = false;
+    config_dirty = false;
+    memset(file_dirty, 0, sizeof(file_dirty));
+    memset(data_dirty, 0, sizeof(data_dirty));
+}
+
+// a checkpoint goes out a few pages per poll. what it covers is fixed when it starts, so the page count
+// in its header still holds if files come and go before it is done, those are just dirty again after it
+static bool checkpointing = false;
+static uint32_t checkpoint_start = 0;
+static uint32_t checkpoint_pages = 0;
+// the header, the config, every file then every chunk of data[], in that order
+static uint32_t checkpoint_item = 0;
+static bool checkpoint_file[max_file_len] = {false};
+static bool checkpoint_chunk[flash_data_chunks] = {false};
+constexpr uint32_t checkpoint_items = 2 + max_file_len + flash_data_chunks;
+
+static bool checkpoint_covers(uint32_t item){
+    if (item < 2){
+        return true;
+    }
+    if (item < 2 + max_file_len){
+        return checkpoint_file[item - 2];
+    }
+    return checkpoint_chunk[item - 2 - max_file_len];
+}
+
+static void begin_checkpoint(){
+    // a checkpoint starts with every file free, only the ones in use need a record
+    checkpoint_pages = 2;
+    for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+        checkpoint_file[file_id] = file_table_in_use(file_id);
+        checkpoint_pages += checkpoint_file[file_id] ? 1 : 0;
+    }
+    for (uint32_t chunk = 0; chunk < flash_data_chunks; chunk++){
+        checkpoint_chunk[chunk] = !chunk_empty(chunk);
+        checkpoint_pages += checkpoint_chunk[chunk] ? 1 : 0;
+    }
+    // everything dirty so far is in it, anything marked from here on is written after it
+    clear_dirty();
+    checkpoint_start = head;
+    checkpoint_item = 0;
+    checkpointing = true;
+}
+
+static bool checkpoint_step(){
+    uint32_t item = checkpoint_item;
+    bool ok;
+    if (item == 0){
+        ok = write_record(FlashRecord::CHECKPOINT, 0, checkpoint_pages, nullptr, 0);
+    }
+    else if (item == 1){
+        ok = write_config();
+    }
+    else if (item < 2 + max_file_len){
+        ok = write_file(item - 2);
+    }
+    else{
+        ok = write_data(item - 2 - max_file_len);
+    }
+    if (!ok){
+        // it can't be finished now, the next one has to start over and cover everything again
+        checkpointing = false;
+        torn = true;
+        any_dirty = true;
+        return false;
+    }
+    item++;
+    while (item < checkpoint_items and !checkpoint_covers(item)){
+        item++;
+    }
+    checkpoint_item = item;
+    if (item == checkpoint_items){
+        checkpoint = checkpoint_start;
+        has_checkpoint = true;
+        torn = false;
+        checkpointing = false;
+    }
+    return true;
+}
+
+// one dirty record, config then files then data[]. its mark is only cleared once it is written
+static bool dirty_step(){
+    if (config_dirty){
+        config_dirty = false;
+        if (!write_config()){
+            config_dirty = true;
+            return false;
+        }
+        return true;
+    }
+    for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+        if (file_dirty[file_id]){
+            file_dirty[file_id] = false;
+            if (!write_file(file_id)){
+                file_dirty[file_id] = true;
+                return false;
+            }
+            return true;
+        }
+    }
+    for (uint32_t chunk = 0; chunk < flash_data_chunks; chunk++){
+        if (data_dirty[chunk]){
+            data_dirty[chunk] = false;
+            if (!write_data(chunk)){
+                data_dirty[chunk] = true;
+                return false;
+            }
+            return true;
+        }
+    }
+    any_dirty = false;
+    return true;
+}
+
+// up to pages records, the checkpoint under way first. false if a write failed
+static bool write_pages(uint32_t pages){
+    if (!scanned){
+        scan();
+    }
+    for (uint32_t page = 0; page < pages; page++){
+        if (!checkpointing){
+            if (!any_dirty){
+                return true;
+            }
+            // leave room for a whole checkpoint ahead of the one being kept, plus the sector about to be erased
+            if (!has_checkpoint or torn or head + 1 - checkpoint > flash_store_pages - flash_checkpoint_pages - 2 * flash_pages_per_sector){
+                begin_checkpoint();
+            }
+        }
+        if (!(checkpointing ? checkpoint_step() : dirty_step())){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool flash_store_flush(){
+    while (checkpointing or any_dirty){
+        if (!write_pages(flash_store_pages_per_poll)){
+            return false;
+        }
+    }
+    return true;
+}
+
+void flash_store_poll(){
+    // a checkpoint that has started carries on whatever else is coming in
+    if (!checkpointing and !(any_dirty and time_us_32() - last_change > flash_store_idle_us)){
+        return;
+    }
+    uint32_t timing = time_us_32();
+    write_pages(flash_store_pages_per_poll);
+    uint32_t took = time_us_32() - timing;
+    if (took > poll_us){
+        poll_us = took;
+    }
+}
+
+static void mark(){
+    any_dirty = true;
+    last_change = time_us_32();
+}
+
+void flash_store_mark_config(){
+    config_dirty = true;
+    mark();
+}
+
+void flash_store_mark_file(uint8_t file_id){
+    file_dirty[file_id] = true;
+    mark();
+}
+
+void flash_store_mark_data(uint32_t index, uint32_t count){
+    if (count == 0 or index >= max_data_len){
+        return;
+    }
+    uint32_t last = index + count - 1 < max_data_len ? index + count - 1 : max_data_len - 1;
+    for (uint32_t chunk = index / flash_record_payload_words; chunk <= last / flash_record_payload_words; chunk++){
+        data_dirty[chunk] = true;
+    }
+    mark();
+}
+
+void flash_store_format(){
+    for (uint32_t offset = 0; offset < flash_store_bytes; offset += flash_sector_bytes){
+        flash_store_erase(offset);
+    }
+    head = 0;
+    checkpoint = 0;
+    has_checkpoint = false;
+    torn = false;
+    checkpointing = false;
+    scanned = true;
+}
+
+void flash_store_reset(){
+    clear_dirty();
+    checkpointing = false;
+    poll_us = 0;
+    scanned = false;
+    has_checkpoint = false;
+    torn = false;
+    head = 0;
+    checkpoint = 0;
+    pages_written = 0;
+    sectors_erased = 0;
+}
@@ -0,0 +1,96 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "pico/time.h"
+
+#include "frame_buffer.h"
+#include "playback.h"
+#include "parallel_output.h"
+#include "output_stage.h"
+#include "led_sequence.h"
+
+
+namespace FrameBuffer{
+    uint32_t buffers[2][max_led_len] = {0};
+    std::atomic<uint8_t> front(0);
+    std::atomic<bool> back_ready(false);
+
+    volatile uint32_t repeated = 0;
+    volatile uint32_t render_us = 0;
+};
+
+using namespace FrameBuffer;
+
+// which refresh of the current content frame is being rendered, only used for TEMPORAL dither
+static uint8_t refresh_index = 0;
+
+
+bool render_pending_frame(){
+    if (back_ready.load(std::memory_order_acquire)){
+        return false;
+    }
+    uint32_t timing = time_us_32();
+    uint8_t back = front.load(std::memory_order_relaxed) ^ 1;
+    uint16_t led_count = light_config.led_count < max_led_len ? light_config.led_count : max_led_len;
+    if ((DitherMode) light_config.dither == DitherMode::TEMPORAL){
+        // new content only every refreshes_per_frame, the refreshes in between re-dither the same frame
+        if (refresh_index == 0){
+            build_next_frame(buffers[back]);
+            load_temporal_frame(buffers[back], led_count);
+        }
+        temporal_dither_frame(buffers[back], led_count);
+        refresh_index = (refresh_index + 1) % frame_refreshes();
+    }
+    else{
+        build_next_frame(buffers[back]);
+        apply_output_stage(buffers[back], led_count);
+        refresh_index = 0;
+    }
+    if (light_config.strip_count > 1){
+        transpose_strips(buffers[back], light_config.strip_count, ParallelOutput::wire[back]);
+    }
+    render_us = time_us_32() - timing;
+    back_ready.store(true, std::memory_order_release);
+    return true;
+}
+
+uint32_t* frame_buffer_swap(){
+    uint8_t current_front = front.load(std::memory_order_relaxed);
+    if (back_ready.load(std::memory_order_acquire)){
+        current_front ^= 1;
+        front.store(current_front, std::memory_order_relaxed);
+        // the old front is free for core 1 now, the DMA finished sending it a tick ago
+        back_ready.store(false, std::memory_order_release);
+    }
+    else if (light_config.running){
+        // core 1 is behind, send the same frame again rather than wait. stopped, it isn't behind at all
+        repeated = repeated + 1;
+    }
+    return buffers[current_front];
+}
+
+void frame_buffer_clear(){
+    // only safe while neither side is running, used at start up and by the host tests
+    memset(buffers, 0, sizeof(buffers));
+    front.store(0);
+    back_ready.store(false);
+    repeated = 0;
+    render_us = 0;
+    refresh_index = 0;
+    clear_temporal_dither();
+}
+
+uint8_t frame_refreshes(){
+    if ((DitherMode) light_config.dither != DitherMode::TEMPORAL or light_config.refreshes_per_frame <= 1){
+        return 1;
+    }
+    // the same wire time sequence_gap_ticks allows for, per strip when they go out in parallel
+    uint16_t led_count = light_config.led_count < max_led_len ? light_config.led_count : max_led_len;
+    uint32_t wire_leds = light_config.strip_count > 1 ? parallel_strip_len(light_config.strip_count) : led_count;
+    uint32_t refresh_us = wire_leds * ws2811_us_per_led + ws2811_latch_us;
+    uint32_t fit = (uint32_t) light_config.fps_ms * 1000 / refresh_us;
+    if (fit < 1){
+        return 1;
+    }
+    return light_config.refreshes_per_frame < fit ? light_config.refreshes_per_frame : (uint8_t) fit;
+}
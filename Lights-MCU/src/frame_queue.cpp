@@ -0,0 +1,63 @@
+#include <atomic>
+#include <cstdint>
+
+#include "frame_queue.h"
+#include "constants.h"
+
+
+namespace FrameQueue{
+    Frame slots[frame_queue_len];
+    std::atomic<uint32_t> head(0);
+    std::atomic<uint32_t> tail(0);
+
+    volatile uint32_t dropped = 0;
+    volatile uint32_t high_water = 0;
+};
+
+using namespace FrameQueue;
+
+static_assert((frame_queue_len & (frame_queue_len - 1)) == 0, "frame_queue_len must be a power of two");
+constexpr uint32_t queue_mask = frame_queue_len - 1;
+
+
+Frame* frame_queue_write_slot(){
+    uint32_t current_head = head.load(std::memory_order_relaxed);
+    if (current_head - tail.load(std::memory_order_acquire) >= frame_queue_len){
+        return nullptr;
+    }
+    return &slots[current_head & queue_mask];
+}
+
+void frame_queue_push(){
+    uint32_t current_head = head.load(std::memory_order_relaxed) + 1;
+    head.store(current_head, std::memory_order_release);
+
+    uint32_t waiting = current_head - tail.load(std::memory_order_relaxed);
+    if (waiting > high_water){
+        high_water = waiting;
+    }
+}
+
+Frame* frame_queue_peek(){
+    uint32_t current_tail = tail.load(std::memory_order_relaxed);
+    if (current_tail == head.load(std::memory_order_acquire)){
+        return nullptr;
+    }
+    return &slots[current_tail & queue_mask];
+}
+
+void frame_queue_pop(){
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+uint32_t frame_queue_count(){
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+void frame_queue_clear(){
+    // only safe while neither side is running, used at start up and by the host tests
+    head.store(0);
+    tail.store(0);
+    dropped = 0;
+    high_water = 0;
+}
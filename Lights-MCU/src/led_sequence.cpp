@@ -0,0 +1,61 @@
+#include <cstdint>
+
+#include "led_sequence.h"
+#include "constants.h"
+#include "playback.h"
+
+
+namespace LedSequence{
+    DmaControlBlock blocks[max_sequence_blocks];
+    volatile uint16_t durations_ms[max_frame_len] = {0};
+    volatile bool running = false;
+    volatile uint32_t loops = 0;
+};
+
+using namespace LedSequence;
+
+// the gap blocks copy this into gap_sink, only the pacing matters
+static const volatile uint32_t gap_source = 0;
+static volatile uint32_t gap_sink = 0;
+
+
+uint32_t sequence_gap_ticks(uint16_t led_count, uint16_t fps_ms){
+    uint32_t frame_us = (uint32_t) led_count * ws2811_us_per_led;
+    uint32_t gap_us = ws2811_latch_us;
+    if ((uint32_t) fps_ms * 1000 > frame_us + gap_us){
+        gap_us = (uint32_t) fps_ms * 1000 - frame_us;
+    }
+    return (gap_us + sequence_gap_tick_us - 1) / sequence_gap_tick_us;
+}
+
+uint16_t sequence_frame_ms(uint16_t frame, uint16_t fps_ms){
+    if (frame >= max_frame_len or durations_ms[frame] == 0){
+        return fps_ms;
+    }
+    return durations_ms[frame];
+}
+
+uint32_t build_led_sequence(uint32_t frame_ctrl, uint32_t gap_ctrl, volatile void* pio_fifo,
+                            uint16_t frame_count, uint16_t led_count, uint16_t fps_ms){
+    if (frame_count > max_frame_len){
+        frame_count = max_frame_len;
+    }
+    if (led_count > max_led_len){
+        led_count = max_led_len;
+    }
+
+    uint32_t index = 0;
+    for (uint16_t frame = 0; frame < frame_count; frame++){
+        uint32_t gap_ticks = sequence_gap_ticks(led_count, sequence_frame_ms(frame, fps_ms));
+        blocks[index++] = {frame_ctrl, led_frame[frame], pio_fifo, led_count};
+        blocks[index++] = {gap_ctrl, &gap_source, &gap_sink, gap_ticks};
+    }
+    // a zero CTRL would clear IRQ_QUIET and EN on the way, and the null trigger would then be silent
+    blocks[index++] = {frame_ctrl, nullptr, nullptr, 0};
+    return index;
+}
+
+bool led_sequence_end(){
+    loops = loops + 1;
+    return running;
+}
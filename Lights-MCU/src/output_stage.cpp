@@ -0,0 +1,217 @@
+#include <cstdint>
+#include <cstring>
+#include "pico.h"
+#include "pico/time.h"
+
+#include "output_stage.h"
+#include "gamma.h"
+#include "playback.h"
+
+#if PICO_ON_DEVICE
+#include "hardware/interp.h"
+#endif
+
+
+namespace OutputStage{
+    uint16_t lut[3][256];
+    uint32_t frame_counter = 0;
+
+    uint16_t intermediate[max_led_len][3];
+    uint8_t carry[max_led_len][3];
+    volatile uint32_t dither_us = 0;
+};
+
+using namespace OutputStage;
+
+// where R, G and B end up for each ColorOrder
+static constexpr uint8_t order_shifts[6][3] = {
+    {24, 16, 8}, // RGB
+    {16, 24, 8}, // GRB
+    {16, 8, 24}, // BRG
+    {24, 8, 16}, // RBG
+    {8, 24, 16}, // GBR
+    {8, 16, 24}, // BGR
+};
+
+// added to the 8.8 value before dropping the fraction. the plain rounding one, then an 8 step
+// ordered pattern that is walked through frame to frame, offset per LED so neighbours don't flicker together
+static constexpr uint16_t round_half = 0x80;
+static constexpr uint16_t dither_pattern[8] = {0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0};
+
+// what the tables were last built for, the gain can never be this so the first call always builds
+static uint32_t lut_brightness = 0;
+static uint32_t lut_gain = 0xFFFFFFFF;
+static uint32_t lut_gamma = 0;
+
+
+void update_output_luts(){
+    uint8_t brightness = light_config.brightness;
+    uint32_t gain = light_config.channel_gain;
+    uint32_t gamma = light_config.gamma;
+    if (brightness == lut_brightness and gain == lut_gain and gamma == lut_gamma){
+        return;
+    }
+    for (uint8_t channel = 0; channel < 3; channel++){
+        uint8_t shift = 16 - 8*channel;
+        uint32_t scale = brightness * ((gain >> shift) & 0xFF);
+        uint8_t curve = (gamma >> shift) & 0xFF;
+        const GammaTable& table = gamma_tables[curve < gamma_curve_count ? curve : 0];
+        for (uint32_t value = 0; value < 256; value++){
+            // /(255*255) rounded, so full scale stays full scale
+            lut[channel][value] = (table.entries[value] * scale + 32512) / 65025;
+        }
+    }
+    lut_brightness = brightness;
+    lut_gain = gain;
+    lut_gamma = gamma;
+}
+
+static bool output_stage_is_identity(){
+    return light_config.brightness == 0xFF and light_config.channel_gain == 0xFFFFFF and light_config.gamma == 0
+        and (DitherMode) light_config.dither == DitherMode::OFF and (ColorOrder) light_config.color_order == ColorOrder::RGB;
+}
+
+static const uint8_t* order_for_config(){
+    uint8_t order = light_config.color_order;
+    return order_shifts[order < 6 ? order : 0];
+}
+
+static inline uint32_t threshold_for(bool dither, uint32_t frame, uint32_t led){
+    return dither ? dither_pattern[(frame + led) & 7] : round_half;
+}
+
+void apply_output_stage_reference(uint32_t* frame, uint32_t led_count){
+    if (output_stage_is_identity()){
+        return;
+    }
+    update_output_luts();
+    uint32_t frame_number = ++frame_counter;
+    // light_config is volatile, read it once rather than per pixel
+    const bool dither = (DitherMode) light_config.dither == DitherMode::ORDERED;
+    const uint8_t* shifts = order_for_config();
+    for (uint32_t i = 0; i < led_count; i++){
+        uint32_t pixel = frame[i];
+        uint32_t threshold = threshold_for(dither, frame_number, i);
+        frame[i] = (((lut[0][pixel >> 24] + threshold) >> 8) << shifts[0])
+                 | (((lut[1][(pixel >> 16) & 0xFF] + threshold) >> 8) << shifts[1])
+                 | (((lut[2][(pixel >> 8) & 0xFF] + threshold) >> 8) << shifts[2])
+                 | (pixel & 0xFF); // the RLE count isn't sent, but keep it for anything reading the frame back
+    }
+}
+
+void load_temporal_frame(const uint32_t* frame, uint32_t led_count){
+    update_output_luts();
+    for (uint32_t i = 0; i < led_count; i++){
+        uint32_t pixel = frame[i];
+        intermediate[i][0] = lut[0][pixel >> 24];
+        intermediate[i][1] = lut[1][(pixel >> 16) & 0xFF];
+        intermediate[i][2] = lut[2][(pixel >> 8) & 0xFF];
+    }
+}
+
+void temporal_dither_frame(uint32_t* frame, uint32_t led_count){
+    uint32_t timing = time_us_32();
+    const uint8_t* shifts = order_for_config();
+    for (uint32_t i = 0; i < led_count; i++){
+        uint32_t word = 0;
+        for (uint8_t channel = 0; channel < 3; channel++){
+            // at most 0xFF00 + 0xFF, so never past 255 once the fraction is dropped
+            uint32_t value = intermediate[i][channel] + carry[i][channel];
+            carry[i][channel] = value & 0xFF;
+            word |= (value >> 8) << shifts[channel];
+        }
+        frame[i] = word;
+    }
+    dither_us = time_us_32() - timing;
+}
+
+void clear_temporal_dither(){
+    // start every LED half way so the first refresh rounds like the other modes
+    memset(carry, 0x80, sizeof(carry));
+    memset(intermediate, 0, sizeof(intermediate));
+    dither_us = 0;
+}
+
+// a kernel per ColorOrder and dither setting, so the shifts and the threshold are constants in the loop
+typedef void (*OutputKernel)(uint32_t* frame, uint32_t led_count, uint32_t frame_number);
+
+#if PICO_ON_DEVICE
+
+static void setup_output_interp(){
+    // each lane pulls one channel byte out of the pixel, already doubled to index the 16 bit table,
+    // and adds its table, so PEEK is the address to read.
+    // interp0 lane 0 is red, lane 1 green and interp1 lane 0 blue. the lanes are per core, this runs on core 1
+    interp_config config = interp_default_config();
+    interp_config_set_mask(&config, 1, 8);
+    interp_config_set_shift(&config, 23);
+    interp_set_config(interp0, 0, &config);
+    interp_config_set_shift(&config, 15);
+    interp_set_config(interp0, 1, &config);
+    interp_config_set_shift(&config, 7);
+    interp_set_config(interp1, 0, &config);
+    interp0->base[0] = (uint32_t) lut[0];
+    interp0->base[1] = (uint32_t) lut[1];
+    interp1->base[0] = (uint32_t) lut[2];
+}
+
+template<ColorOrder order, bool dither>
+static void output_kernel(uint32_t* frame, uint32_t led_count, uint32_t frame_number){
+    constexpr uint8_t red_shift = order_shifts[(uint8_t) order][0];
+    constexpr uint8_t green_shift = order_shifts[(uint8_t) order][1];
+    constexpr uint8_t blue_shift = order_shifts[(uint8_t) order][2];
+    for (uint32_t i = 0; i < led_count; i++){
+        uint32_t pixel = frame[i];
+        uint32_t threshold = threshold_for(dither, frame_number, i);
+        interp0->accum[0] = pixel;
+        interp0->accum[1] = pixel;
+        interp1->accum[0] = pixel;
+        frame[i] = (((*(const uint16_t*) interp0->peek[0] + threshold) >> 8) << red_shift)
+                 | (((*(const uint16_t*) interp0->peek[1] + threshold) >> 8) << green_shift)
+                 | (((*(const uint16_t*) interp1->peek[0] + threshold) >> 8) << blue_shift)
+                 | (pixel & 0xFF);
+    }
+}
+
+#else
+
+static void setup_output_interp(){}
+
+template<ColorOrder order, bool dither>
+static void output_kernel(uint32_t* frame, uint32_t led_count, uint32_t frame_number){
+    constexpr uint8_t red_shift = order_shifts[(uint8_t) order][0];
+    constexpr uint8_t green_shift = order_shifts[(uint8_t) order][1];
+    constexpr uint8_t blue_shift = order_shifts[(uint8_t) order][2];
+    for (uint32_t i = 0; i < led_count; i++){
+        uint32_t pixel = frame[i];
+        uint32_t threshold = threshold_for(dither, frame_number, i);
+        frame[i] = (((lut[0][pixel >> 24] + threshold) >> 8) << red_shift)
+                 | (((lut[1][(pixel >> 16) & 0xFF] + threshold) >> 8) << green_shift)
+                 | (((lut[2][(pixel >> 8) & 0xFF] + threshold) >> 8) << blue_shift)
+                 | (pixel & 0xFF);
+    }
+}
+
+#endif
+
+// indexed by ColorOrder then ORDERED dither
+static constexpr OutputKernel output_kernels[6][2] = {
+    {output_kernel<ColorOrder::RGB, false>, output_kernel<ColorOrder::RGB, true>},
+    {output_kernel<ColorOrder::GRB, false>, output_kernel<ColorOrder::GRB, true>},
+    {output_kernel<ColorOrder::BRG, false>, output_kernel<ColorOrder::BRG, true>},
+    {output_kernel<ColorOrder::RBG, false>, output_kernel<ColorOrder::RBG, true>},
+    {output_kernel<ColorOrder::GBR, false>, output_kernel<ColorOrder::GBR, true>},
+    {output_kernel<ColorOrder::BGR, false>, output_kernel<ColorOrder::BGR, true>},
+};
+
+void apply_output_stage(uint32_t* frame, uint32_t led_count){
+    if (output_stage_is_identity()){
+        return;
+    }
+    update_output_luts();
+    uint32_t frame_number = ++frame_counter;
+    // light_config is volatile, read it once and pick the kernel for it
+    const bool dither = (DitherMode) light_config.dither == DitherMode::ORDERED;
+    uint8_t order = light_config.color_order;
+    setup_output_interp();
+    output_kernels[order < 6 ? order : 0][dither](frame, led_count, frame_number);
+}
@@ -0,0 +1,114 @@
+#include <cstdint>
+
+#include "parallel_output.h"
+#include "constants.h"
+
+
+namespace ParallelOutput{
+    Strip strips[max_strips] = {{0, 0}};
+    uint32_t wire[2][max_led_len * parallel_words_per_led] = {{0}};
+};
+
+using namespace ParallelOutput;
+
+
+void layout_strips_evenly(uint8_t strip_count, uint16_t led_count){
+    if (led_count > max_led_len){
+        led_count = max_led_len;
+    }
+    uint16_t per_strip = (led_count + strip_count - 1) / strip_count;
+    uint16_t start = 0;
+    for (uint8_t s = 0; s < max_strips; s++){
+        uint16_t count = 0;
+        if (s < strip_count and start < led_count){
+            count = (led_count - start) < per_strip ? (led_count - start) : per_strip;
+        }
+        strips[s] = {start, count};
+        start += count;
+    }
+}
+
+uint16_t parallel_strip_len(uint8_t strip_count){
+    uint16_t longest = 0;
+    for (uint8_t s = 0; s < strip_count and s < max_strips; s++){
+        if (strips[s].led_count > longest){
+            longest = strips[s].led_count;
+        }
+    }
+    return longest;
+}
+
+// gather LED led of every strip, black for strips that are shorter or not in use
+static inline void strip_colors(const uint32_t* frame, uint8_t strip_count, uint16_t led, uint32_t* colors){
+    for (uint8_t s = 0; s < max_strips; s++){
+        colors[s] = (s < strip_count and led < strips[s].led_count) ? frame[strips[s].start + led] : 0;
+    }
+}
+
+uint32_t transpose_strips_reference(const uint32_t* frame, uint8_t strip_count, uint32_t* wire){
+    if (strip_count > max_strips){
+        strip_count = max_strips;
+    }
+    uint16_t led_count = parallel_strip_len(strip_count);
+    uint32_t index = 0;
+    for (uint16_t led = 0; led < led_count; led++){
+        uint32_t colors[max_strips];
+        strip_colors(frame, strip_count, led, colors);
+        // the color is the top 24 bits, the RLE count underneath is never sent
+        uint32_t word = 0;
+        for (uint8_t bit = 0; bit < ws2811_bits_per_led; bit++){
+            uint8_t slice = 0;
+            for (uint8_t s = 0; s < max_strips; s++){
+                slice |= ((colors[s] >> (31 - bit)) & 1) << s;
+            }
+            word = (word << 8) | slice;
+            if (bit % 4 == 3){
+                wire[index++] = word;
+            }
+        }
+    }
+    return index;
+}
+
+/*
+    8x8 bit matrix transpose held in two words, Hacker's Delight transpose8.
+    In: a byte per strip, x = [strip 7][strip 6][strip 5][strip 4], y = [strip 3] .. [strip 0]
+    Out: a byte per bit, x = [bit 7][bit 6][bit 5][bit 4], y = [bit 3] .. [bit 0], bit s of each being strip s.
+    That is already the wire layout, so the two words go straight out
+*/
+static inline void transpose8(uint32_t& x, uint32_t& y){
+    uint32_t t;
+    // swap 1 bit blocks across the diagonal of each 2x2
+    t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+    // then 2x2 blocks within each 4x4
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    // then the 4x4 blocks between the two halves
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+}
+
+uint32_t transpose_strips(const uint32_t* frame, uint8_t strip_count, uint32_t* wire){
+    if (strip_count > max_strips){
+        strip_count = max_strips;
+    }
+    uint16_t led_count = parallel_strip_len(strip_count);
+    uint32_t index = 0;
+    for (uint16_t led = 0; led < led_count; led++){
+        uint32_t colors[max_strips];
+        strip_colors(frame, strip_count, led, colors);
+        // one 8x8 transpose for each of the three color bytes, top byte first
+        for (uint8_t shift = 24; shift >= 8; shift -= 8){
+            uint32_t x = ((colors[7] >> shift) & 0xFF) << 24 | ((colors[6] >> shift) & 0xFF) << 16
+                       | ((colors[5] >> shift) & 0xFF) << 8 | ((colors[4] >> shift) & 0xFF);
+            uint32_t y = ((colors[3] >> shift) & 0xFF) << 24 | ((colors[2] >> shift) & 0xFF) << 16
+                       | ((colors[1] >> shift) & 0xFF) << 8 | ((colors[0] >> shift) & 0xFF);
+            transpose8(x, y);
+            wire[index++] = x;
+            wire[index++] = y;
+        }
+    }
+    return index;
+}
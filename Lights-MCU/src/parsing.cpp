@@ -1,10 +1,24 @@
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include "pico/time.h"
+#include "pico.h"
 
 #include "parsing.h"
 #include "constants.h"
+#include "crc16.h"
+#include "frame_queue.h"
 #include <files.h>
+#include "playback.h"
+#include "parallel_output.h"
+#include "output_stage.h"
+#include "gamma.h"
+#include "effects.h"
+#include "led_sequence.h"
+#include "storage.h"
+#include "flash_store.h"
+#include "arena.h"
+#include "light_hal.h"
 #include <hardware/uart.h>
 
 
@@ -14,23 +28,48 @@ namespace Parsing{
 
     volatile ParseState uart_parsing_state = ParseState::WAIT_START;
 
-    volatile uint8_t uart_buffer[uart_buffer_len];
-    volatile uint8_t uart_working_index = 0;
+    volatile uint16_t uart_working_index = 0;
     volatile uint8_t payload_len = 0;
     volatile uint32_t command_payload[64]; // len max is 256, so max is /4 of that
+    volatile uint16_t frame_crc = CRC16_INIT;
+    volatile uint16_t received_crc = 0;
 };
 
+// the queue slot the current frame is going into.
+// when the queue is full the frame is still parsed, into discard_frame, and then counted as dropped
+static Frame discard_frame;
+static Frame* volatile rx_frame = &discard_frame;
+
+namespace Stream{
+    volatile bool active = false;
+    volatile uint8_t file_id = 0;
+    volatile uint32_t start = 0;
+    volatile uint32_t total = 0;
+    volatile uint32_t cursor = 0;
+    volatile uint16_t expected_seq = 0;
+    volatile uint16_t window = 1;
+    volatile uint16_t chunks_since_ack = 0;
+    volatile uint32_t generation = 0;
+    volatile uint32_t finished = 0;
+};
+
+// the chunk currently being parsed
+static uint8_t stream_header[STREAM_HEADER_LEN];
+static uint16_t stream_seq = 0;
+static uint16_t stream_len = 0;
+static uint16_t stream_bytes_read = 0;
+static uint32_t stream_word = 0;
+static ProtoError stream_error = ProtoError::OK;
+// only one NAK per gap, the chunks the host already had in flight behind it are dropped quietly
+static bool stream_nak_sent = false;
+// up around each word the parser puts in data[], so core 1 can wait out the one in flight before freeing the block
+static std::atomic<bool> stream_writing(false);
+
 
 using namespace Parsing;
 
 
 
-extern volatile Animation_Config light_config;
-extern volatile uint32_t led_frame[max_frame_len][max_led_len];
-extern volatile File files[255];
-extern volatile uint32_t data[];
-extern volatile uint8_t current_file;
-extern volatile uint32_t playback_location;
 // extern volatile uint32_t fps_time_ms;
 
 // template<typename T>
@@ -39,18 +78,146 @@ void clear_uart_buffer(char* buff, uint16_t buff_len){
     for (int i = 0; i < buff_len; i++){buff[i]=0;}
 }
 
-bool verify_crc(volatile uint8_t *input_buffer, uint8_t len){
-    // TODO: add some checking here, right now, assume its good for testing
-    return true;
+bool verify_crc(){
+    // frame_crc has been kept up to date as the bytes came in, so this is just a compare
+    return frame_crc == received_crc;
 }
 
 /*
     [1 B]   [1 B]       [1 B]           [1 B]               [N B]       [2 B]   [1 B]
     [Start] [Version]   [Command ID]    [Payload Length]    [Payload]   [CRC]   [End]
     -       [0]         [1]             [2]                 [3]     
-
+    CRC is CRC-16/CCITT-FALSE over Version through Payload, sent high byte first
 */
 
+static void put_word(volatile uint8_t* buffer, uint32_t value){
+    buffer[0] = (value >> 24) & 0xFF;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = value & 0xFF;
+}
+
+// hand core 1 a STREAM_ACK frame, same as if the host had sent one with [next sequence, error, complete]
+static void queue_stream_ack(ProtoError error, bool complete){
+    Frame* frame = frame_queue_write_slot();
+    if (frame == nullptr){
+        // the host times out and asks with an empty STREAM_ACK, a finished file is filled in then
+        FrameQueue::dropped = FrameQueue::dropped + 1;
+        return;
+    }
+    frame->buffer[0] = 0x01; // version
+    frame->buffer[1] = (uint8_t) CommandState::STREAM_ACK;
+    frame->buffer[2] = 3*4;
+    put_word(&frame->buffer[3], Stream::expected_seq);
+    put_word(&frame->buffer[7], (uint8_t) error);
+    put_word(&frame->buffer[11], complete);
+    frame->error = ProtoError::OK;
+    frame->time_received = time_us_32();
+    frame->from_parser = true;
+    frame_queue_push();
+}
+
+static void check_stream_chunk(){
+    stream_seq = (stream_header[0] << 8) | stream_header[1];
+    stream_len = (stream_header[2] << 8) | stream_header[3];
+    stream_bytes_read = 0;
+    stream_error = ProtoError::OK;
+    bool active = Stream::active;
+    // whatever core 1 did to the block before opening the stream is in before anything lands in it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!active){
+        stream_error = ProtoError::INVALID_PARAM;
+    }
+    else if (stream_seq != Stream::expected_seq){
+        stream_error = ProtoError::BAD_HEADER;
+    }
+    else if (stream_len % 4 != 0){
+        stream_error = ProtoError::BAD_PAYLOAD_LEN;
+    }
+    else if (stream_len/4 > Stream::start + Stream::total - Stream::cursor){
+        stream_error = ProtoError::PAYLOAD_TOO_LONG;
+    }
+}
+
+static void finish_stream_chunk(){
+    // read before active, a stop on core 1 that this chunk missed has already moved it on
+    uint32_t generation = Stream::generation;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (stream_error == ProtoError::OK and !Stream::active){
+        // stopped by core 1 part way through the chunk
+        stream_error = ProtoError::INVALID_PARAM;
+    }
+    if (stream_error == ProtoError::OK and !verify_crc()){
+        stream_error = ProtoError::BAD_CHECKSUM;
+    }
+    if (stream_error != ProtoError::OK){
+        // anything already written for this chunk is past the cursor, the resend writes over it
+        if (!stream_nak_sent){
+            stream_nak_sent = true;
+            Stream::chunks_since_ack = 0;
+            queue_stream_ack(stream_error, false);
+        }
+        return;
+    }
+    stream_nak_sent = false;
+    Stream::cursor = Stream::cursor + stream_len/4;
+    Stream::expected_seq = Stream::expected_seq + 1;
+    Stream::chunks_since_ack = Stream::chunks_since_ack + 1;
+    bool complete = Stream::cursor == Stream::start + Stream::total;
+    if (complete){
+        // every word is in before core 1 can see the block as movable or fill in the file
+        std::atomic_thread_fence(std::memory_order_release);
+        Stream::finished = generation;
+        Stream::active = false;
+    }
+    if (complete or Stream::chunks_since_ack >= Stream::window){
+        Stream::chunks_since_ack = 0;
+        queue_stream_ack(ProtoError::OK, complete);
+    }
+}
+
+static void stream_stop(){
+    Stream::active = false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // a chunk finishing right now can't count as a finished upload any more. after active, so a
+    // parser that reads the new generation is sure to see the stream stopped too
+    Stream::generation = Stream::generation + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // the parser either saw active go false or is part way through a word, which is over in a few cycles
+    while (stream_writing.load(std::memory_order_acquire)){
+        tight_loop_contents();
+    }
+}
+
+// fill in the file entry if the parser got every word of stream generation in, core 1 only.
+// goes with whichever STREAM_ACK comes next, the parser's own or an empty one from the host
+// if the parser's didn't fit in the queue
+static void stream_finish(uint32_t generation){
+    if (generation == 0 or Stream::finished != generation){
+        return;
+    }
+    // pairs with the release before the parser set finished
+    std::atomic_thread_fence(std::memory_order_acquire);
+    Stream::finished = 0;
+    // not Stream::start, compaction may have moved the block since the last chunk went in
+    uint8_t file_id = Stream::file_id;
+    files.end[file_id] = files.start[file_id] + Stream::total - 1;
+    files.action[file_id] = EndAction::REPEAT;
+    flash_store_mark_file(file_id);
+    flash_store_mark_data(files.start[file_id], Stream::total);
+}
+
+// before file_id's block is freed or moved out from under the parser. an upload that is
+// already in is filled in first, so whatever comes next starts from the finished file
+static void stream_stop_for(uint32_t file_id){
+    if (Stream::file_id != file_id){
+        return;
+    }
+    uint32_t generation = Stream::generation;
+    stream_stop();
+    stream_finish(generation);
+}
+
 void process_byte(volatile char working_byte){
     // uart_putc_raw(uart0, '`');
     // uart_putc(uart0, working_byte);
@@ -60,15 +227,28 @@ void process_byte(volatile char working_byte){
     switch (uart_parsing_state) {
         case ParseState::WAIT_START:
             if (working_byte == START_CONDITION) {
+                rx_frame = frame_queue_write_slot();
+                if (rx_frame == nullptr){
+                    rx_frame = &discard_frame;
+                }
                 uart_working_index = 0;
+                frame_crc = CRC16_INIT;
+                received_crc = 0;
                 uart_parsing_state = ParseState::READ_HEADER;
             }
+            else if (working_byte == STREAM_START_CONDITION) {
+                uart_working_index = 0;
+                frame_crc = CRC16_INIT;
+                received_crc = 0;
+                uart_parsing_state = ParseState::READ_STREAM_HEADER;
+            }
             break;
 
         case ParseState::READ_HEADER:
-            uart_buffer[uart_working_index++] = working_byte;
+            rx_frame->buffer[uart_working_index++] = working_byte;
+            frame_crc = crc16_update(frame_crc, working_byte);
             if (uart_working_index == HEADER_LEN) { // VERSION, CMD_ID, LEN
-                payload_len = uart_buffer[2]; // LEN
+                payload_len = rx_frame->buffer[2]; // LEN
                 if (payload_len == 0x00){
                     uart_parsing_state = ParseState::READ_CRC;
                 }
@@ -79,37 +259,89 @@ void process_byte(volatile char working_byte){
             break;
 
         case ParseState::READ_PAYLOAD:
-            uart_buffer[uart_working_index++] = working_byte;
+            rx_frame->buffer[uart_working_index++] = working_byte;
+            frame_crc = crc16_update(frame_crc, working_byte);
             if (uart_working_index == HEADER_LEN + payload_len) {
                 uart_parsing_state = ParseState::READ_CRC;
             }
             break;
 
         case ParseState::READ_CRC:
-            uart_buffer[uart_working_index++] = working_byte;
-            if (uart_working_index == HEADER_LEN + CRC_LEN + payload_len) { // CRC low + high
+            rx_frame->buffer[uart_working_index++] = working_byte;
+            received_crc = (received_crc << 8) | (uint8_t) working_byte;
+            if (uart_working_index == HEADER_LEN + CRC_LEN + payload_len) { // CRC high + low
                 uart_parsing_state = ParseState::WAIT_END;
             }
             break;
 
         case ParseState::WAIT_END:
             if (working_byte == END_CONDITION) {
-                if (verify_crc(uart_buffer, uart_working_index - 2)) {
-                    // handle_message(buffer, idx - 2);
-                    uart_parsing_state= ParseState::WAIT_FOR_PROCESSING;
-                    
+                if (verify_crc()) {
+                    rx_frame->error = ProtoError::OK;
                 } else {
-                    // send_error_response(ProtoError::BAD_CHECKSUM);
-                    // TODO: handle error case
+                    // still hand it over so the host gets told, the payload is not run
+                    rx_frame->error = ProtoError::BAD_CHECKSUM;
+                }
+                rx_frame->time_received = time_us_32();
+                rx_frame->from_parser = false;
+                if (rx_frame == &discard_frame){
+                    FrameQueue::dropped = FrameQueue::dropped + 1;
+                }
+                else{
+                    frame_queue_push();
                 }
             }
-            else{
-                uart_parsing_state = ParseState::WAIT_START;
+            // either way the parser is straight back to looking for the next frame,
+            // core 1 works through the queue at its own pace
+            uart_parsing_state = ParseState::WAIT_START;
+            break;
+
+        case ParseState::READ_STREAM_HEADER:
+            stream_header[uart_working_index++] = working_byte;
+            frame_crc = crc16_update(frame_crc, working_byte);
+            if (uart_working_index == STREAM_HEADER_LEN) { // SEQUENCE, LEN
+                check_stream_chunk();
+                uart_working_index = 0;
+                if (stream_len == 0){
+                    uart_parsing_state = ParseState::READ_STREAM_CRC;
+                }
+                else{
+                    uart_parsing_state = ParseState::READ_STREAM_PAYLOAD;
+                }
             }
             break;
-        case ParseState::WAIT_FOR_PROCESSING:
-            // do nothing
-            // handled elsewhere
+
+        case ParseState::READ_STREAM_PAYLOAD:
+            // straight into data[], nothing is staged
+            frame_crc = crc16_update(frame_crc, working_byte);
+            stream_word = (stream_word << 8) | (uint8_t) working_byte;
+            stream_bytes_read++;
+            if (stream_bytes_read % 4 == 0 and stream_error == ProtoError::OK){
+                // the other half of stream_stop, one of the two always sees the other's store
+                stream_writing.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (Stream::active){
+                    data[Stream::cursor + stream_bytes_read/4 - 1] = stream_word;
+                }
+                stream_writing.store(false, std::memory_order_release);
+            }
+            if (stream_bytes_read == stream_len) {
+                uart_parsing_state = ParseState::READ_STREAM_CRC;
+            }
+            break;
+
+        case ParseState::READ_STREAM_CRC:
+            received_crc = (received_crc << 8) | (uint8_t) working_byte;
+            if (++uart_working_index == CRC_LEN) {
+                uart_parsing_state = ParseState::WAIT_STREAM_END;
+            }
+            break;
+
+        case ParseState::WAIT_STREAM_END:
+            if (working_byte == END_CONDITION) {
+                finish_stream_chunk();
+            }
+            uart_parsing_state = ParseState::WAIT_START;
             break;
     }
     
@@ -119,6 +351,10 @@ void config_set(JsonDocument& result, uint32_t config_id, uint32_t config_value)
     // JsonDocument result;
     result["value"] = config_id;
     result["error"] = (uint8_t) ProtoError::OK;
+    // errors and values that are already set don't need saving again
+    Animation_Config config_before;
+    memcpy(&config_before, (const void*) &light_config, sizeof(Animation_Config));
+    uint8_t file_before = current_file;
     switch((ConfigIndex) config_id){
         case ConfigIndex::echo:
             // Echoing back the number. useful for debugging
@@ -169,8 +405,80 @@ void config_set(JsonDocument& result, uint32_t config_id, uint32_t config_value)
             light_config.status_report = (bool) config_value;
             break;
         case ConfigIndex::current_file:
+            if (config_value >= max_file_len){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
             current_file = (uint8_t) config_value;
-            playback_location = files[current_file].start;
+            playback_location = files.start[current_file];
+            playback_slot = 0;
+            break;
+        case ConfigIndex::binary_reply:
+            if (config_value > 0x01){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.binary_reply = (bool) config_value;
+            break;
+        case ConfigIndex::dma_sequence:
+            if (config_value > 0x01){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.dma_sequence = (bool) config_value;
+            break;
+        case ConfigIndex::strip_count:
+            // max_strips is what the PIO program can drive, this board only has pins for some of them
+            if (config_value == 0x00 or config_value > max_strips or config_value > WS2811_PARALLEL_PINS){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            // an even split to start with, STRIP_SET can change each one after
+            layout_strips_evenly((uint8_t) config_value, light_config.led_count);
+            light_config.strip_count = (uint8_t) config_value;
+            break;
+        case ConfigIndex::brightness:
+            if (config_value > 0xFF){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.brightness = (uint8_t) config_value;
+            break;
+        case ConfigIndex::channel_gain:
+            if (config_value > 0xFFFFFF){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.channel_gain = config_value;
+            break;
+        case ConfigIndex::color_order:
+            if (config_value > (uint8_t) ColorOrder::BGR){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.color_order = (uint8_t) config_value;
+            break;
+        case ConfigIndex::gamma:
+            if (((config_value >> 16) & 0xFF) >= gamma_curve_count or ((config_value >> 8) & 0xFF) >= gamma_curve_count
+                    or (config_value & 0xFF) >= gamma_curve_count or config_value > 0xFFFFFF){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.gamma = config_value;
+            break;
+        case ConfigIndex::dither:
+            if (config_value > (uint8_t) DitherMode::TEMPORAL){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.dither = (uint8_t) config_value;
+            break;
+        case ConfigIndex::refreshes_per_frame:
+            if (config_value == 0x00 or config_value > max_refreshes_per_frame){
+                result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+                break;
+            }
+            light_config.refreshes_per_frame = (uint8_t) config_value;
             break;
         default:
             result["error"] = (uint8_t) ProtoError::INVALID_PARAM;
@@ -178,6 +486,9 @@ void config_set(JsonDocument& result, uint32_t config_id, uint32_t config_value)
             break;
 
     }
+    if (memcmp(&config_before, (const void*) &light_config, sizeof(Animation_Config)) != 0 or current_file != file_before){
+        flash_store_mark_config();
+    }
     return;
 }
 
@@ -210,6 +521,33 @@ void config_get(JsonDocument& result, uint32_t config_id){
             result["value"] = light_config.status_report;
             // return {(uint32_t) light_config.debug_cmd, ProtoError::OK};
             break;
+        case ConfigIndex::binary_reply:
+            result["value"] = light_config.binary_reply;
+            break;
+        case ConfigIndex::dma_sequence:
+            result["value"] = light_config.dma_sequence;
+            break;
+        case ConfigIndex::strip_count:
+            result["value"] = light_config.strip_count;
+            break;
+        case ConfigIndex::brightness:
+            result["value"] = light_config.brightness;
+            break;
+        case ConfigIndex::channel_gain:
+            result["value"] = light_config.channel_gain;
+            break;
+        case ConfigIndex::color_order:
+            result["value"] = light_config.color_order;
+            break;
+        case ConfigIndex::gamma:
+            result["value"] = light_config.gamma;
+            break;
+        case ConfigIndex::dither:
+            result["value"] = light_config.dither;
+            break;
+        case ConfigIndex::refreshes_per_frame:
+            result["value"] = light_config.refreshes_per_frame;
+            break;
         default:
             result["error"] = (uint8_t) ProtoError::INVALID_PARAM;
             // return {(uint32_t) config_id, ProtoError::INVALID_PARAM};
@@ -225,13 +563,13 @@ void color_set(JsonDocument& result, uint32_t frame_id, uint32_t led_id, uint32_
     // JsonDocument result;
     result["value"] = led_id;
     result["error"] = (uint8_t) ProtoError::OK;
-    if (frame_id > max_frame_len){
+    if (frame_id >= max_frame_len){
         result["value"] = frame_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
         return;
         // return {(uint32_t) frame_id, ProtoError::OUT_OF_RANGE};
     }
-    if (led_id > max_led_len){
+    if (led_id >= max_led_len){
         result["value"] = led_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
         // return {(uint32_t) led_id, ProtoError::OUT_OF_RANGE};
@@ -246,7 +584,7 @@ void multi_color_set(JsonDocument& result, uint32_t frame_id, uint32_t starting_
     // JsonDocument result;
     result["value"] = starting_led_id;
     result["error"] = (uint8_t) ProtoError::OK;
-    if (frame_id > max_frame_len){
+    if (frame_id >= max_frame_len){
         result["value"] = frame_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
         return;
@@ -273,7 +611,7 @@ void file_set(JsonDocument& result, uint32_t file_id, uint32_t starting_location
     // JsonDocument result;
     result["value"] = file_id;
     result["error"] = (uint8_t) ProtoError::OK;
-    if (file_id > 255){
+    if (file_id >= max_file_len){
         result["extra"] = "File Id";
         result["value"] = file_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
@@ -281,14 +619,45 @@ void file_set(JsonDocument& result, uint32_t file_id, uint32_t starting_location
         // return {(uint32_t) file_id, ProtoError::OUT_OF_RANGE};
     }
     
-    if (starting_location + color_array_len > max_data_len){
+    uint32_t word_count = color_array_len > 3 ? color_array_len - 3 : 0;
+    if (files.storage[file_id] == StorageKind::SRAM){
+        // the arena picks where it goes, starting_location is only for the other backends
+        bool appending = update == 1 and files.reserved[file_id] != 0;
+        uint32_t used = files.end[file_id] + 1 > files.start[file_id] ? files.end[file_id] + 1 - files.start[file_id] : 0;
+        uint32_t old_start = files.start[file_id];
+        stream_stop_for(file_id);
+        if (!(appending ? arena_grow(file_id, used + word_count) : arena_reserve(file_id, word_count))){
+            result["extra"] = "Length";
+            result["value"] = appending ? used + word_count : word_count;
+            result["error"] = (uint8_t) ProtoError::BUFFER_OVERFLOW;
+            return;
+        }
+        file_table_use(file_id);
+        uint32_t current_location = files.start[file_id] + (appending ? used : 0);
+        files.end[file_id] = current_location + word_count - 1;
+        for (uint32_t i = 0; i < word_count; i++){
+            data[current_location + i] = color_array[3 + i];
+        }
+        files.action[file_id] = EndAction::REPEAT;
+        if (file_id == current_file and files.start[file_id] != old_start and !appending){
+            playback_location = files.start[file_id];
+            playback_slot = 0;
+        }
+        flash_store_mark_file(file_id);
+        flash_store_mark_data(current_location, word_count);
+        return;
+    }
+
+    // start and end are in whichever backend the file is stored in
+    const StorageBackend& backend = storage_backend(files.storage[file_id]);
+    if (starting_location + color_array_len > backend.word_count){
         result["extra"] = "Starting Location";
         result["value"] = starting_location;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
         return;
         // return {(uint32_t) starting_location, ProtoError::OUT_OF_RANGE};
     }
-    if (update == 1 and files[file_id].end + color_array_len > max_data_len){
+    if (update == 1 and files.end[file_id] + color_array_len > backend.word_count){
         result["extra"] = "Ending Location";
         result["value"] = file_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
@@ -296,32 +665,54 @@ void file_set(JsonDocument& result, uint32_t file_id, uint32_t starting_location
         // return {(uint32_t) starting_location, ProtoError::OUT_OF_RANGE};
     }
     uint32_t current_location = 0;
-    files[file_id].start = starting_location;
     if (update == 1){
-        current_location = files[file_id].end +1;
-        files[file_id].end = files[file_id].end + color_array_len  -3;
+        current_location = files.end[file_id] +1;
     }
     else{
         current_location = starting_location;
-        files[file_id].end = starting_location + color_array_len - 1 -3;
     }
-    
-    files[file_id].action = EndAction::REPEAT;
+
+    uint32_t words[64];
     int temp_index = 0;
     for (int i =3; i<color_array_len; i++ ){
-        data[current_location + temp_index] = color_array[i];
+        words[temp_index] = color_array[i];
         temp_index++;
     }
+    if (!storage_write(files.storage[file_id], current_location, words, temp_index)){
+        result["extra"] = "Storage";
+        result["value"] = (uint8_t) files.storage[file_id];
+        result["error"] = (uint8_t) ProtoError::INVALID_PARAM;
+        return;
+    }
+
+    file_table_use(file_id);
+    files.start[file_id] = starting_location;
+    if (update == 1){
+        files.end[file_id] = files.end[file_id] + color_array_len  -3;
+    }
+    else{
+        files.end[file_id] = starting_location + color_array_len - 1 -3;
+    }
+    
+    files.action[file_id] = EndAction::REPEAT;
+    // only the file entry, the words are already kept through a power cycle or never will be
+    flash_store_mark_file(file_id);
     // return {file_id, ProtoError::OK};
     return;
 }
 
 void file_get(JsonDocument& result, uint32_t file_id){
     // JsonDocument result;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["value"] = file_id;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
     result["value"][0] = file_id;
-    result["value"][1] = files[file_id].start;
-    result["value"][2] = files[file_id].end;
-    result["value"][3] = (uint8_t) files[file_id].action;
+    result["value"][1] = files.start[file_id];
+    result["value"][2] = files.end[file_id];
+    result["value"][3] = (uint8_t) files.action[file_id];
     result["error"] = (uint8_t) ProtoError::OK;
     
     return;
@@ -331,27 +722,86 @@ void file_clear(JsonDocument& result, uint32_t file_id){
     // JsonDocument result;
     result["value"] = file_id;
     result["error"] = (uint8_t) ProtoError::OK;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
     
-    for (int i=files[file_id].start; i< files[file_id].end; i++){
-        data[i] = 0;
+    // nothing more may land in the block once it is zeroed
+    stream_stop_for(file_id);
+    if (files.storage[file_id] == StorageKind::SRAM and files.reserved[file_id] != 0){
+        for (uint32_t i = files.start[file_id]; i < files.start[file_id] + files.reserved[file_id]; i++){
+            data[i] = 0;
+        }
+        flash_store_mark_data(files.start[file_id], files.reserved[file_id]);
+        // the hole is closed up by compaction on core 1
+        arena_free(file_id);
     }
-    files[file_id].start = 0;
-    files[file_id].end = 0;
+    // back on the free list for FILE_NEW
+    file_table_release(file_id);
+    Effects::settings[file_id] = {};
+    flash_store_mark_file(file_id);
 
     return;
 }
 
+void file_format(JsonDocument& result, Command& working_command){
+    uint32_t file_id = working_command.payload[0];
+    result["value"] = file_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    if (working_command.payload_len == 1){
+        JsonArray value = result["value"].to<JsonArray>();
+        value.add((uint8_t) files.format[file_id]);
+        value.add(files.palette[file_id]);
+        return;
+    }
+
+    uint32_t format = working_command.payload[1];
+    uint32_t palette = working_command.payload[2];
+    if (format >= file_format_count){
+        result["extra"] = "Format";
+        result["value"] = format;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    // every index a packed word can hold has to land inside the palette file's block
+    uint16_t entries = palette_len((FileFormat) format);
+    if (entries != 0 and (palette >= max_file_len or files.storage[palette] != StorageKind::SRAM
+            or files.reserved[palette] < entries)){
+        result["extra"] = "Palette";
+        result["value"] = palette;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    file_table_use(file_id);
+    files.format[file_id] = (FileFormat) format;
+    files.palette[file_id] = (uint16_t) palette;
+    flash_store_mark_file(file_id);
+    if (file_id == current_file){
+        // a slot means something different in the new format, start the file over
+        playback_location = files.start[file_id];
+        playback_slot = 0;
+    }
+}
+
 void color_get(JsonDocument& result, uint32_t frame_id, uint32_t led_id){
     // JsonDocument result;
     result["value"] = frame_id;
     result["error"] = (uint8_t) ProtoError::OK;
-    if (frame_id > light_config.frame_count){
+    // frame_count and led_count can be set past the end of led_frame
+    if (frame_id >= max_frame_len or frame_id > light_config.frame_count){
         result["value"] = frame_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
         return;
         // return {(uint32_t) frame_id, ProtoError::OUT_OF_RANGE};
     }
-    if (led_id > light_config.led_count){
+    if (led_id >= max_led_len or led_id > light_config.led_count){
         result["value"] = led_id;
         result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
         return;
@@ -362,6 +812,327 @@ void color_get(JsonDocument& result, uint32_t frame_id, uint32_t led_id){
     return;
 }
 
+void handle_command(JsonDocument& result, Command& working_command);
+
+void frame_duration(JsonDocument& result, Command& working_command){
+    uint32_t frame_id = working_command.payload[0];
+    result["value"] = frame_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (frame_id >= max_frame_len){
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    if (working_command.payload_len == 1){
+        result["value"] = LedSequence::durations_ms[frame_id];
+        return;
+    }
+    uint32_t duration = working_command.payload[1];
+    if (duration > 0xFFFF){
+        result["value"] = duration;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    // picked up the next time round the sequence, it is rebuilt at the end of every loop
+    LedSequence::durations_ms[frame_id] = (uint16_t) duration;
+}
+
+void file_storage(JsonDocument& result, Command& working_command){
+    uint32_t file_id = working_command.payload[0];
+    result["value"] = file_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    if (working_command.payload_len == 1){
+        JsonArray value = result["value"].to<JsonArray>();
+        value.add((uint8_t) files.storage[file_id]);
+        value.add(storage_backend(files.storage[file_id]).word_count);
+        return;
+    }
+    uint32_t kind = working_command.payload[1];
+    if (kind >= storage_kind_count){
+        result["extra"] = "Storage";
+        result["value"] = kind;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    // the words already there are left alone, so a file can be pointed at something already in flash
+    file_table_use(file_id);
+    if ((StorageKind) kind != files.storage[file_id]){
+        // start and end mean nothing in the new backend's terms when it is data[], that is the arena's to hand out
+        stream_stop_for(file_id);
+        arena_free(file_id);
+        if ((StorageKind) kind == StorageKind::SRAM){
+            files.start[file_id] = 0;
+            files.end[file_id] = 0;
+        }
+    }
+    files.storage[file_id] = (StorageKind) kind;
+    flash_store_mark_file(file_id);
+    if (file_id == current_file){
+        playback_location = files.start[file_id];
+        playback_slot = 0;
+    }
+}
+
+void effect_set(JsonDocument& result, Command& working_command){
+    uint32_t file_id = working_command.payload[0];
+    result["value"] = file_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    EffectSettings& effect = Effects::settings[file_id];
+    if (working_command.payload_len == 1){
+        JsonArray value = result["value"].to<JsonArray>();
+        value.add((uint8_t) effect.id);
+        for (uint8_t i = 0; i < effect_param_count; i++){
+            value.add(effect.params[i]);
+        }
+        return;
+    }
+    if (working_command.payload_len > 2 + effect_param_count){
+        result["error"] = (uint8_t) ProtoError::BAD_PAYLOAD_LEN;
+        return;
+    }
+    uint32_t effect_id = working_command.payload[1];
+    if (effect_id >= effect_count){
+        result["extra"] = "Effect";
+        result["value"] = effect_id;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    file_table_use(file_id);
+    effect.id = (EffectId) effect_id;
+    for (uint8_t i = 0; i < effect_param_count; i++){
+        effect.params[i] = 2 + i < working_command.payload_len ? working_command.payload[2 + i] : 0;
+    }
+    stream_stop_for(file_id);
+    arena_free(file_id);
+    files.start[file_id] = 0;
+    files.end[file_id] = 0;
+    files.action[file_id] = EndAction::FUNCTION;
+    flash_store_mark_file(file_id);
+    if (file_id == current_file){
+        playback_location = 0;
+    }
+}
+
+void file_alloc(JsonDocument& result, uint32_t file_id, uint32_t words){
+    result["value"] = file_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    if (files.storage[file_id] != StorageKind::SRAM){
+        result["extra"] = "Storage";
+        result["error"] = (uint8_t) ProtoError::INVALID_PARAM;
+        return;
+    }
+    // the block may move, the parser can't carry on writing where it was
+    stream_stop_for(file_id);
+    // keeps what is already in the file, so FILE_SET appends don't have to move it again
+    if (!arena_grow(file_id, words)){
+        result["extra"] = "Length";
+        result["value"] = words;
+        result["error"] = (uint8_t) ProtoError::BUFFER_OVERFLOW;
+        return;
+    }
+    file_table_use(file_id);
+    flash_store_mark_file(file_id);
+    result["value"] = files.start[file_id];
+}
+
+void file_new(JsonDocument& result){
+    uint8_t file_id = 0;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (!file_table_new(file_id)){
+        result["value"] = max_file_len;
+        result["error"] = (uint8_t) ProtoError::BUFFER_OVERFLOW;
+        return;
+    }
+    // nothing in it yet, but it is saved as in use so it isn't handed out again after a power cycle
+    flash_store_mark_file(file_id);
+    result["value"] = file_id;
+}
+
+void file_list(JsonDocument& result, uint32_t first){
+    // the entries themselves go out in the long reply handle_pending_command sends from here, see send_file_list
+    result["value"] = first;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (first >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+    }
+}
+
+void strip_set(JsonDocument& result, uint32_t strip_id, uint32_t start, uint32_t led_count){
+    result["value"] = strip_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (strip_id >= max_strips){
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    if (start + led_count > max_led_len){
+        result["value"] = start + led_count;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    ParallelOutput::strips[strip_id] = {(uint16_t) start, (uint16_t) led_count};
+}
+
+/*
+    BATCH payload is a run of sub-commands packed back to back, each one being
+    [1 word]                                    [N words]
+    [Command ID << 24 | Payload Length (words)] [Payload]
+    Reply value is a bitmap with bit i set if sub-command i failed, error is the first failure (or OK)
+    BATCH and FILE_LIST can't be sub-commands, a FILE_LIST's reply is a whole long frame of its own
+*/
+void batch(JsonDocument& result, Command& working_command){
+    // walk the whole thing first so a malformed batch doesn't get half applied
+    uint8_t command_count = 0;
+    uint8_t index = 0;
+    while (index < working_command.payload_len){
+        CommandState sub_id = (CommandState) (working_command.payload[index] >> 24);
+        uint8_t sub_len = working_command.payload[index] & 0xFF;
+        if (sub_id == CommandState::BATCH or sub_id == CommandState::FILE_LIST){
+            result["value"] = command_count;
+            result["error"] = (uint8_t) ProtoError::BAD_COMMAND;
+            return;
+        }
+        if (index + 1 + sub_len > working_command.payload_len){
+            result["value"] = command_count;
+            result["error"] = (uint8_t) ProtoError::BAD_PAYLOAD_LEN;
+            return;
+        }
+        if (++command_count > max_batch_len){
+            result["value"] = max_batch_len;
+            result["error"] = (uint8_t) ProtoError::PAYLOAD_TOO_LONG;
+            return;
+        }
+        index += 1 + sub_len;
+    }
+
+    // handlers read fixed argument slots without checking the length, so short commands get
+    // zero padded the same way parse_payload pads a single command
+    volatile uint32_t short_payload[4];
+    uint32_t failed = 0;
+    ProtoError first_error = ProtoError::OK;
+    index = 0;
+    for (uint8_t i = 0; i < command_count; i++){
+        Command sub_command = {
+            (CommandState) (working_command.payload[index] >> 24),
+            &working_command.payload[index + 1],
+            (uint8_t) (working_command.payload[index] & 0xFF),
+            false
+        };
+        if (sub_command.payload_len < 4){
+            for (uint8_t j = 0; j < 4; j++){
+                short_payload[j] = j < sub_command.payload_len ? sub_command.payload[j] : 0;
+            }
+            sub_command.payload = short_payload;
+        }
+
+        result.clear();
+        handle_command(result, sub_command);
+        ProtoError error = (ProtoError) result["error"].as<uint8_t>();
+        if (error != ProtoError::OK){
+            failed |= 1u << i;
+            if (first_error == ProtoError::OK){
+                first_error = error;
+            }
+        }
+        index += 1 + sub_command.payload_len;
+    }
+
+    result.clear();
+    result["value"] = failed;
+    result["error"] = (uint8_t) first_error;
+}
+
+void stream_start(JsonDocument& result, uint32_t file_id, uint32_t total_words, uint32_t window){
+    result["value"] = file_id;
+    result["error"] = (uint8_t) ProtoError::OK;
+    if (file_id >= max_file_len){
+        result["extra"] = "File Id";
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    if (files.storage[file_id] != StorageKind::SRAM){
+        // chunks are written straight into data[] from the parser
+        result["extra"] = "Storage";
+        result["error"] = (uint8_t) ProtoError::INVALID_PARAM;
+        return;
+    }
+    if (total_words == 0 or total_words > max_data_len){
+        result["extra"] = "Length";
+        result["value"] = total_words;
+        result["error"] = (uint8_t) ProtoError::OUT_OF_RANGE;
+        return;
+    }
+    // starting again drops whatever stream was open before, its block can be moved again.
+    // one that finished without its STREAM_ACK being run is kept
+    uint32_t generation = Stream::generation;
+    stream_stop();
+    stream_finish(generation);
+    uint32_t old_start = files.start[file_id];
+    if (!arena_reserve(file_id, total_words)){
+        result["extra"] = "Length";
+        result["value"] = total_words;
+        result["error"] = (uint8_t) ProtoError::BUFFER_OVERFLOW;
+        return;
+    }
+    if (files.start[file_id] != old_start){
+        // whatever the file held is gone, it plays its first word until the stream is in
+        files.end[file_id] = files.start[file_id];
+        if (file_id == current_file){
+            playback_location = files.start[file_id];
+            playback_slot = 0;
+        }
+    }
+    file_table_use(file_id);
+    flash_store_mark_file(file_id);
+    Stream::file_id = (uint8_t) file_id;
+    Stream::start = files.start[file_id];
+    Stream::total = total_words;
+    Stream::cursor = files.start[file_id];
+    Stream::expected_seq = 0;
+    Stream::window = (window == 0 or window > 0xFFFF) ? 1 : (uint16_t) window;
+    Stream::chunks_since_ack = 0;
+    Stream::generation = Stream::generation + 1;
+    stream_nak_sent = false;
+    // the block is done with on this side before the parser starts writing into it
+    std::atomic_thread_fence(std::memory_order_release);
+    Stream::active = true;
+}
+
+void stream_ack(JsonDocument& result, Command& working_command){
+    stream_finish(Stream::generation);
+    if (working_command.payload_len == 0){
+        // the host asking where to carry on from
+        result["value"] = Stream::expected_seq;
+        result["error"] = (uint8_t) ProtoError::OK;
+        return;
+    }
+    if (!working_command.from_parser){
+        // only the parser knows when every word is in, a host sending [seq, error, complete] would finish a half uploaded file
+        result["value"] = Stream::expected_seq;
+        result["extra"] = "Payload";
+        result["error"] = (uint8_t) ProtoError::INVALID_PARAM;
+        return;
+    }
+    // queued by the parser, [next sequence, error, complete]. the file was filled in above,
+    // unless it was cleared or started over in between and the stream with it
+    result["value"] = working_command.payload[0];
+    result["error"] = (uint8_t) working_command.payload[1];
+}
+
 void handle_command(JsonDocument& result, Command& working_command){
     // JsonDocument result;
     switch (working_command.id){
@@ -383,13 +1154,38 @@ void handle_command(JsonDocument& result, Command& working_command){
         case CommandState::COLOR_SET:
             return color_set(result, working_command.payload[0], working_command.payload[1], working_command.payload[2]);
         case CommandState::MULTI_COLOR_SET:
-            return multi_color_set(result, working_command.payload[0], working_command.payload[1], working_command.payload_len, working_command.payload);
+            // the colors start after the frame and led ids
+            return multi_color_set(result, working_command.payload[0], working_command.payload[1], working_command.payload_len > 2 ? working_command.payload_len - 2 : 0, working_command.payload);
         case CommandState::COLOR_GET:
             return color_get(result, working_command.payload[0], working_command.payload[1]);
         case CommandState::FILE_SET:
             return file_set(result, working_command.payload[0], working_command.payload[1], working_command.payload[2], working_command.payload_len, working_command.payload);
         case CommandState::FILE_GET:
             return file_get(result, working_command.payload[0]);
+        case CommandState::FILE_CLEAR:
+            return file_clear(result, working_command.payload[0]);
+        case CommandState::BATCH:
+            return batch(result, working_command);
+        case CommandState::STREAM_START:
+            return stream_start(result, working_command.payload[0], working_command.payload[2], working_command.payload[3]);
+        case CommandState::STREAM_ACK:
+            return stream_ack(result, working_command);
+        case CommandState::STRIP_SET:
+            return strip_set(result, working_command.payload[0], working_command.payload[1], working_command.payload[2]);
+        case CommandState::FILE_FORMAT:
+            return file_format(result, working_command);
+        case CommandState::EFFECT_SET:
+            return effect_set(result, working_command);
+        case CommandState::FRAME_DURATION:
+            return frame_duration(result, working_command);
+        case CommandState::FILE_STORAGE:
+            return file_storage(result, working_command);
+        case CommandState::FILE_ALLOC:
+            return file_alloc(result, working_command.payload[0], working_command.payload[1]);
+        case CommandState::FILE_NEW:
+            return file_new(result);
+        case CommandState::FILE_LIST:
+            return file_list(result, working_command.payload[0]);
         default:
             result["value"] = (uint8_t) working_command.id;
             result["error"] = (uint8_t) ProtoError::BAD_COMMAND;
@@ -400,7 +1196,7 @@ void handle_command(JsonDocument& result, Command& working_command){
 }
 
 
-void parse_payload(JsonDocument& result, volatile uint8_t* payload_data, uint8_t len) {
+void parse_payload(JsonDocument& result, volatile uint8_t* payload_data, uint8_t len, bool from_parser) {
     // JsonDocument result;
     if (payload_data[0] != 0x01){
         result["value"] = 0;
@@ -451,7 +1247,7 @@ void parse_payload(JsonDocument& result, volatile uint8_t* payload_data, uint8_t
     //         break;
     // };
     
-    Command working_command = {cmd_id, command_payload, working_array_index};
+    Command working_command = {cmd_id, command_payload, working_array_index, from_parser};
 
     handle_command(result, working_command);
 
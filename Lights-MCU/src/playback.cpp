@@ -0,0 +1,404 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "playback.h"
+#include "constants.h"
+#include "files.h"
+#include "effects.h"
+#include "storage.h"
+
+
+volatile Animation_Config light_config = default_light_config;
+
+volatile uint8_t current_file = 0;
+volatile uint32_t playback_location = 0;
+volatile uint16_t playback_slot = 0;
+
+// what a DELTA file has built up so far. the frame buffers go through the output stage in place,
+// so the deltas have to be applied to a copy that only ever holds content
+static uint32_t delta_canvas[max_led_len] = {0};
+
+// the two keyframes either side of the current fade, decoded once when the fade starts. kept by
+// file and where the fade is in it, a staged file's location is the same whichever part is staged
+static uint32_t keyframe_from[max_led_len] = {0};
+static uint32_t keyframe_to[max_led_len] = {0};
+static uint32_t keyframe_location = UINT32_MAX;
+static uint8_t keyframe_file = 0;
+
+uint32_t data[max_data_len] = {0};
+
+
+volatile uint32_t led_frame[max_frame_len][max_led_len] = {0};
+volatile uint32_t working_frame_index = 0;
+
+
+uint32_t rgb_to_int(uint8_t red, uint8_t green, uint8_t blue){
+    // format is GRB
+    uint32_t rgb = (red << 16)|(green<<8) | blue;
+    return rgb;
+}
+
+uint32_t rgb565_to_int(uint16_t color){
+    uint8_t red = color >> 11;
+    uint8_t green = (color >> 5) & 0x3F;
+    uint8_t blue = color & 0x1F;
+    return rgb_to_int((red << 3) | (red >> 2), (green << 2) | (green >> 4), (blue << 3) | (blue >> 2));
+}
+
+uint32_t lerp_color(uint32_t from, uint32_t to, uint32_t weight){
+    // red and blue are far enough apart to share a multiply, green gets its own
+    uint32_t inverse = 256 - weight;
+    uint32_t a = from >> 8;
+    uint32_t b = to >> 8;
+    uint32_t red_blue = (((a & 0xFF00FF) * inverse + (b & 0xFF00FF) * weight) >> 8) & 0xFF00FF;
+    uint32_t green = (((a & 0x00FF00) * inverse + (b & 0x00FF00) * weight) >> 8) & 0x00FF00;
+    return ((red_blue | green) << 8) | 1;
+}
+
+void default_file_0(){
+    // setup a basic static color for file 0
+    uint8_t temp = 0x05;
+    data[0] =  temp+ (rgb_to_int(168, 136, 20) << 8);
+    temp = 95;
+    data[1] =  temp+ (rgb_to_int(100, 100, 100) << 8);
+    files.start[0] = 0;
+    files.end[0] = 1;
+    files.action[0] = EndAction::REPEAT;
+    files.format[0] = FileFormat::RLE;
+    files.storage[0] = StorageKind::SRAM;
+    files.reserved[0] = 2;
+    file_table_use(0);
+    playback_location = files.start[0];
+    playback_slot = 0;
+
+}
+
+// the current file read out of the volatiles once a frame, the kernels work from this
+// so nothing in their loops has to go back to memory
+struct FrameCursor{
+    const uint32_t* words; // data[], or a staging buffer for a file kept somewhere else
+    uint32_t start;
+    uint32_t end;
+    bool repeat;
+    uint8_t file_id;
+    const uint32_t* palette; // always in data[]
+    uint32_t location; // playback_location, written back once the frame is done
+    uint16_t slot; // playback_slot
+    uint32_t real_location; // playback_location as it was, not rebased onto a staging buffer
+};
+
+typedef void (*FrameKernel)(uint32_t* frame, uint16_t led_count, FrameCursor& cursor);
+
+static inline uint32_t run_length(uint32_t word){
+    uint32_t count = word & 0xFF;
+    return count == 0 ? 1 : count;
+}
+
+static void build_rle_frame(uint32_t* frame, uint16_t led_count, FrameCursor& cursor){
+    const uint32_t* words = cursor.words;
+    uint32_t location = cursor.location;
+    if (location > cursor.end){
+        location = cursor.repeat ? cursor.start : cursor.end;
+    }
+    // a run is filled in one go rather than counting it down a LED at a time
+    uint32_t count = run_length(words[location]);
+    uint32_t i = 0;
+    bool wrapped_early = false;
+    while (i < led_count){
+        uint32_t color = words[location];
+        uint32_t run = count < led_count - i ? count : led_count - i;
+        if (run == 1){
+            // short of a vector fill, content with little repetition is mostly these
+            frame[i] = color;
+        }
+        else{
+            for (uint32_t k = 0; k < run; k++){
+                frame[i + k] = color;
+            }
+        }
+        i += run;
+        count -= run;
+        if (count == 0){
+            location++;
+            if (location > cursor.end){
+                if (cursor.repeat){
+                    // the file should end on a frame boundary
+                    wrapped_early = wrapped_early or i != led_count;
+                    location = cursor.start;
+                }
+                else{
+                    // anything other than REPEAT holds on the last entry rather than reading off the end of the file
+                    location = cursor.end;
+                }
+            }
+            count = run_length(words[location]);
+        }
+    }
+    if (wrapped_early){
+        printf("Something has gone wrong");
+    }
+    cursor.location = location;
+}
+
+// one LED per slot, so unlike the RLE there is no count to keep track of, just where in the word we are.
+// the shifts and masks are all known at compile time, so a whole word is unrolled
+template<FileFormat format>
+static void build_packed_frame(uint32_t* frame, uint16_t led_count, FrameCursor& cursor){
+    constexpr uint32_t per_word = leds_per_word(format);
+    constexpr uint32_t bits = 32 / per_word;
+    constexpr uint32_t mask = (1u << bits) - 1;
+    const uint32_t* words = cursor.words;
+    const uint32_t* palette = cursor.palette;
+    auto decode = [palette](uint32_t value){
+        if constexpr (format == FileFormat::RGB565){
+            return (rgb565_to_int(value) << 8) | 1;
+        }
+        else{
+            return palette[value];
+        }
+    };
+
+    uint32_t location = cursor.location;
+    uint32_t slot = cursor.slot < per_word ? cursor.slot : 0;
+    if (location > cursor.end){
+        location = cursor.repeat ? cursor.start : cursor.end;
+    }
+    uint32_t i = 0;
+    while (i < led_count){
+        uint32_t word = words[location];
+        if (slot == 0 and led_count - i >= per_word){
+            for (uint32_t k = 0; k < per_word; k++){
+                frame[i + k] = decode((word >> (32 - bits * (k + 1))) & mask);
+            }
+            i += per_word;
+            slot = per_word;
+        }
+        else{
+            // the word the last frame stopped part way through, or the last few LEDs of this one
+            for (; slot < per_word and i < led_count; slot++, i++){
+                frame[i] = decode((word >> (32 - bits * (slot + 1))) & mask);
+            }
+        }
+        if (slot == per_word){
+            slot = 0;
+            location++;
+            if (location > cursor.end){
+                // anything other than REPEAT holds on the last word rather than reading off the end of the file
+                location = cursor.repeat ? cursor.start : cursor.end;
+            }
+        }
+    }
+    cursor.location = location;
+    cursor.slot = slot;
+}
+
+static void build_delta_frame(uint32_t* frame, uint16_t led_count, FrameCursor& cursor){
+    const uint32_t* words = cursor.words;
+    uint32_t location = cursor.location;
+
+    if (location > cursor.end){
+        if (!cursor.repeat){
+            // past the last frame, keep showing it
+            memcpy(frame, delta_canvas, led_count * sizeof(uint32_t));
+            return;
+        }
+        location = cursor.start;
+    }
+    if (location == cursor.start){
+        memset(delta_canvas, 0, sizeof(delta_canvas));
+    }
+
+    // only the changed runs are touched, a frame that changes nothing costs one word
+    uint32_t entries = words[location++] & 0xFFFF;
+    for (uint32_t entry = 0; entry < entries and location + 1 <= cursor.end; entry++){
+        uint32_t span = words[location++];
+        uint32_t color = words[location++];
+        uint32_t first = span >> 16;
+        uint32_t last = first + (span & 0xFFFF);
+        if (last > max_led_len){
+            last = max_led_len;
+        }
+        for (uint32_t i = first; i < last; i++){
+            delta_canvas[i] = color;
+        }
+    }
+    if (location > cursor.end and cursor.repeat){
+        location = cursor.start;
+    }
+    cursor.location = location;
+    memcpy(frame, delta_canvas, led_count * sizeof(uint32_t));
+}
+
+// expand entries RLE words from location into a whole frame, anything they don't cover is off.
+// a header can claim more entries than the file (or the staged window) has left, only available are read
+static void decode_keyframe(const uint32_t* words, uint32_t entries, uint32_t available, uint32_t* frame){
+    if (entries > available){
+        entries = available;
+    }
+    uint32_t i = 0;
+    for (uint32_t entry = 0; entry < entries and i < max_led_len; entry++){
+        uint32_t word = words[entry];
+        for (uint32_t count = run_length(word); count > 0 and i < max_led_len; count--){
+            frame[i++] = word;
+        }
+    }
+    for (; i < max_led_len; i++){
+        frame[i] = 0;
+    }
+}
+
+static void build_keyframe_frame(uint32_t* frame, uint16_t led_count, FrameCursor& cursor){
+    const uint32_t* words = cursor.words;
+    uint32_t location = cursor.location;
+    uint32_t elapsed = cursor.slot;
+    if (location < cursor.start or location > cursor.end){
+        location = cursor.start;
+        elapsed = 0;
+    }
+
+    uint32_t header = words[location];
+    uint32_t next = location + 1 + (header & 0xFFFF);
+    if (next > cursor.end){
+        // the last keyframe, show it once and go round again or stay on it
+        decode_keyframe(&words[location + 1], header & 0xFFFF, cursor.end - location, keyframe_from);
+        keyframe_location = UINT32_MAX;
+        memcpy(frame, keyframe_from, led_count * sizeof(uint32_t));
+        cursor.location = cursor.repeat ? cursor.start : location;
+        cursor.slot = 0;
+        return;
+    }
+
+    uint32_t next_header = words[next];
+    uint32_t duration = (next_header >> 16) > (header >> 16) ? (next_header >> 16) - (header >> 16) : 1;
+    // elapsed is 0 whenever location was moved above, so real_location is where the fade is
+    if (elapsed == 0 or keyframe_location != cursor.real_location or keyframe_file != cursor.file_id){
+        decode_keyframe(&words[location + 1], header & 0xFFFF, next - location - 1, keyframe_from);
+        decode_keyframe(&words[next + 1], next_header & 0xFFFF, cursor.end - next, keyframe_to);
+        keyframe_location = cursor.real_location;
+        keyframe_file = cursor.file_id;
+    }
+
+    // the per LED cost is the same however long the fade is
+    uint32_t weight = (elapsed << 8) / duration;
+    for (uint16_t i = 0; i < led_count; i++){
+        frame[i] = lerp_color(keyframe_from[i], keyframe_to[i], weight);
+    }
+
+    if (++elapsed >= duration){
+        location = next;
+        elapsed = 0;
+    }
+    cursor.location = location;
+    cursor.slot = elapsed;
+}
+
+static void build_effect_frame(uint32_t* frame, uint16_t led_count, FrameCursor& cursor){
+    // nothing stored to read through, playback_location just counts the frames for the effect
+    render_effect(cursor.file_id, frame, led_count, cursor.location);
+    cursor.location++;
+}
+
+// indexed by FileFormat, EndAction::FUNCTION files go to build_effect_frame whatever their format
+static constexpr FrameKernel format_kernels[file_format_count] = {
+    build_rle_frame,
+    build_packed_frame<FileFormat::RGB565>,
+    build_packed_frame<FileFormat::PALETTE8>,
+    build_packed_frame<FileFormat::PALETTE4>,
+    build_delta_frame,
+    build_keyframe_frame,
+};
+
+// the palette file's words. one without a block of data[], never given one or cleared since, reads as
+// all off rather than whatever its start of 0 points at
+static const uint32_t* palette_words(uint16_t palette, FileFormat format){
+    static const uint32_t no_palette[palette_len(FileFormat::PALETTE8)] = {0};
+    if (palette >= max_file_len or files.reserved[palette] == 0
+        or files.start[palette] + palette_len(format) > max_data_len){
+        return no_palette;
+    }
+    return &data[files.start[palette]];
+}
+
+void build_next_frame(uint32_t* frame){
+    // set up the next frame for the next loop. The DMA is happening in the background so we dont have to worry about timeing
+    // everything volatile is read once here and written back once at the end, the kernel picked
+    // for the file's format only ever sees plain memory
+    const uint8_t file_id = current_file;
+    uint16_t led_count = light_config.led_count < max_led_len ? light_config.led_count : max_led_len;
+    const EndAction action = files.action[file_id];
+    const uint8_t format = (uint8_t) files.format[file_id];
+    const StorageKind storage = files.storage[file_id];
+
+    FrameCursor cursor = {
+        data,
+        files.start[file_id],
+        files.end[file_id],
+        action == EndAction::REPEAT,
+        file_id,
+        palette_words(files.palette[file_id], (FileFormat) format),
+        playback_location,
+        playback_slot,
+        playback_location,
+    };
+    FrameKernel kernel = action == EndAction::FUNCTION ? build_effect_frame
+                       : format_kernels[format < file_format_count ? format : 0];
+
+    if (storage == StorageKind::SRAM or action == EndAction::FUNCTION){
+        kernel(frame, led_count, cursor);
+    }
+    else{
+        // the kernel runs on a copy in SRAM with everything rebased onto it, then the window for
+        // the next frame starts coming in while this one is on its way out
+        StagedFrame staged = stage_frame(storage, file_id, cursor.start, cursor.end, cursor.location);
+        cursor.words = staged.words;
+        cursor.start = staged.start;
+        cursor.end = staged.end;
+        cursor.location = staged.location;
+        kernel(frame, led_count, cursor);
+        cursor.location = unstage_location(staged, cursor.location);
+        prefetch_frame(storage, file_id, files.start[file_id], files.end[file_id], cursor.location);
+    }
+
+    playback_location = cursor.location;
+    playback_slot = cursor.slot;
+}
+
+void build_rle_frame_reference(uint32_t* frame){
+    // the RLE decoder as it was, a LED at a time through volatile
+    volatile int i = 0;
+    volatile uint8_t count = 0;
+    volatile uint32_t* words = data;
+
+    uint16_t led_count = light_config.led_count < max_led_len ? light_config.led_count : max_led_len;
+    count = words[playback_location] & 0xFF;
+    if (count == 0){
+        count =1;
+    }
+    for (i=0; i<led_count; i++){
+        --count;
+        frame[i] = words[playback_location];
+        if (count == 0){
+            playback_location += 1;
+            count = words[playback_location] &0xFF;
+            if (count == 0){
+                count =1;
+            }
+
+        }
+
+
+        if (playback_location > files.end[current_file]){
+            if (files.action[current_file] == EndAction::REPEAT){
+                if (i != (led_count - 1)){
+                    printf("Something has gone wrong");
+                }
+                playback_location = (uint32_t) files.start[current_file];
+            }
+            else if (files.action[current_file] == EndAction::RUN_FILE){
+                // TODO: figure out a way to set this kind of info
+            }
+
+        }
+    }
+}
@@ -0,0 +1,227 @@
+#include <cstdint>
+#include <cstring>
+#include "pico.h"
+
+#include "storage.h"
+#include "playback.h"
+
+
+namespace Prefetch{
+    uint32_t stage[2][2 * prefetch_window_len] = {0};
+    volatile uint32_t hits = 0;
+    volatile uint32_t misses = 0;
+    volatile uint32_t generation = 0;
+};
+
+using namespace Prefetch;
+
+// what one of the stage buffers holds. location is the start of the window, or start when the file
+// is staged as one run
+struct StageKey{
+    bool valid;
+    StorageKind kind;
+    uint8_t file_id;
+    uint32_t start;
+    uint32_t end;
+    uint32_t location;
+    uint32_t generation;
+
+    bool operator==(const StageKey& other) const{
+        return valid and other.valid and kind == other.kind and file_id == other.file_id and start == other.start
+            and end == other.end and location == other.location and generation == other.generation;
+    }
+};
+
+static StageKey staged[2] = {};
+// the head of a split buffer, only read again when the file changes
+static StageKey heads[2] = {};
+// a start_read in flight into that buffer
+static bool pending[2] = {false, false};
+static uint8_t last_used = 0;
+
+
+static bool sram_read(uint32_t index, uint32_t* dest, uint32_t count){
+    if (index + count > max_data_len){
+        return false;
+    }
+    memcpy(dest, &data[index], count * sizeof(uint32_t));
+    return true;
+}
+
+static bool sram_write(uint32_t index, const uint32_t* src, uint32_t count){
+    if (index + count > max_data_len){
+        return false;
+    }
+    memcpy(&data[index], src, count * sizeof(uint32_t));
+    return true;
+}
+
+static bool sram_read_done(){
+    return true;
+}
+
+const StorageBackend sram_backend = {"sram", max_data_len, sram_read, sram_write, sram_read, sram_read_done};
+
+const StorageBackend& storage_backend(StorageKind kind){
+    switch (kind){
+        case StorageKind::XIP_FLASH:
+            return xip_flash_backend;
+        case StorageKind::PSRAM:
+            return psram_backend;
+        default:
+            return sram_backend;
+    }
+}
+
+bool storage_write(StorageKind kind, uint32_t index, const uint32_t* src, uint32_t count){
+    const StorageBackend& backend = storage_backend(kind);
+    if (backend.write == nullptr or index + count > backend.word_count){
+        return false;
+    }
+    generation = generation + 1;
+    return backend.write(index, src, count);
+}
+
+// one run of the file when it is short or the location is still near its start, otherwise head and window
+static bool staged_whole(uint32_t start, uint32_t end, uint32_t location){
+    return end - start + 1 <= 2 * prefetch_window_len or location - start < prefetch_window_len;
+}
+
+static StageKey key_for(StorageKind kind, uint8_t file_id, uint32_t start, uint32_t end, uint32_t location){
+    if (staged_whole(start, end, location)){
+        location = start;
+    }
+    return {true, kind, file_id, start, end, location, generation};
+}
+
+static uint32_t min_words(uint32_t a, uint32_t b){
+    return a < b ? a : b;
+}
+
+// the read into buffer b is over. each buffer asks the backend that started its read, the other
+// one can be from a different file on a different backend
+static void wait_for(uint8_t b){
+    if (!pending[b]){
+        return;
+    }
+    const StorageBackend& backend = storage_backend(staged[b].kind);
+    while (!backend.read_done()){
+        tight_loop_contents();
+    }
+    pending[b] = false;
+}
+
+static void wait_for_pending(){
+    wait_for(0);
+    wait_for(1);
+}
+
+// read key into buffer b. the window goes through start_read when background is set
+static void fill(uint8_t b, const StageKey& key, bool background){
+    const StorageBackend& backend = storage_backend(key.kind);
+    uint32_t* buffer = stage[b];
+    staged[b] = key;
+    if (key.location == key.start){
+        uint32_t count = min_words(key.end - key.start + 1, 2 * prefetch_window_len);
+        if (background){
+            pending[b] = backend.start_read(key.start, buffer, count);
+        }
+        else{
+            backend.read(key.start, buffer, count);
+        }
+        heads[b] = {};
+        return;
+    }
+
+    StageKey head = key;
+    head.location = key.start;
+    head.end = 0;
+    if (!(heads[b] == head)){
+        backend.read(key.start, buffer, prefetch_window_len);
+        heads[b] = head;
+    }
+    uint32_t count = min_words(key.end - key.location + 1, prefetch_window_len);
+    if (background){
+        pending[b] = backend.start_read(key.location, &buffer[prefetch_window_len], count);
+    }
+    else{
+        backend.read(key.location, &buffer[prefetch_window_len], count);
+    }
+}
+
+StagedFrame stage_frame(StorageKind kind, uint8_t file_id, uint32_t start, uint32_t end, uint32_t location){
+    if (location < start){
+        location = start;
+    }
+    // past the end is left for the kernel to deal with, but staged from the end
+    uint32_t stage_location = location > end ? end : location;
+    StageKey key = key_for(kind, file_id, start, end, stage_location);
+
+    int8_t found = -1;
+    for (uint8_t b = 0; b < 2; b++){
+        if (staged[b] == key){
+            found = b;
+        }
+    }
+    if (found >= 0){
+        wait_for(found);
+        hits = hits + 1;
+    }
+    else{
+        // the read ahead guessed wrong or never happened, get it now
+        misses = misses + 1;
+        wait_for_pending();
+        found = last_used ^ 1;
+        fill(found, key, false);
+    }
+    last_used = found;
+
+    StagedFrame frame;
+    frame.words = stage[found];
+    frame.start = 0;
+    frame.real_start = start;
+    frame.real_location = key.location;
+    frame.split = key.location != start;
+    if (!frame.split){
+        uint32_t count = min_words(end - start + 1, 2 * prefetch_window_len);
+        // a file longer than the buffer never gets as far as the last word from a location this near the start
+        frame.end = count - 1;
+        frame.location = location - start;
+    }
+    else{
+        uint32_t count = min_words(end - key.location + 1, prefetch_window_len);
+        frame.end = key.location + count - 1 == end ? prefetch_window_len + count - 1 : 2 * prefetch_window_len - 1;
+        frame.location = prefetch_window_len + (location - key.location);
+    }
+    return frame;
+}
+
+uint32_t unstage_location(const StagedFrame& staged_frame, uint32_t location){
+    if (!staged_frame.split or location < prefetch_window_len){
+        return staged_frame.real_start + location;
+    }
+    return staged_frame.real_location + (location - prefetch_window_len);
+}
+
+void prefetch_frame(StorageKind kind, uint8_t file_id, uint32_t start, uint32_t end, uint32_t location){
+    if (kind == StorageKind::SRAM or pending[0] or pending[1]){
+        return;
+    }
+    if (location < start){
+        location = start;
+    }
+    StageKey key = key_for(kind, file_id, start, end, location > end ? end : location);
+    if (staged[0] == key or staged[1] == key){
+        return;
+    }
+    fill(last_used ^ 1, key, true);
+}
+
+void prefetch_clear(){
+    wait_for_pending();
+    staged[0] = staged[1] = {};
+    heads[0] = heads[1] = {};
+    last_used = 0;
+    hits = 0;
+    misses = 0;
+}
@@ -0,0 +1,242 @@
+#include <cstdint>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/dma.h"
+#include "hardware/spi.h"
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+
+#include "storage.h"
+#include "flash_store.h"
+#include "light_hal.h"
+
+// only in the firmware, the host build has host/storage_file.cpp in its place
+
+static int xip_dma_chan = -1;
+static int psram_tx_chan = -1;
+static int psram_rx_chan = -1;
+// the read start_read left running, CS goes back up once it has finished
+static bool psram_reading = false;
+
+// APS6404 commands, plain SPI mode. 0x03 reads with no wait cycles up to 33 MHz
+constexpr uint8_t psram_cmd_read = 0x03;
+constexpr uint8_t psram_cmd_write = 0x02;
+constexpr uint8_t psram_cmd_reset_enable = 0x66;
+constexpr uint8_t psram_cmd_reset = 0x99;
+// writes can't run over the end of a page, reads can at this speed
+constexpr uint32_t psram_page_bytes = 1024;
+
+
+static const uint32_t* xip_words(uint32_t index){
+    // the no cache alias, so playing a file doesn't push the firmware's own code out of the XIP cache
+    return (const uint32_t*) (XIP_NOCACHE_NOALLOC_BASE + storage_xip_offset) + index;
+}
+
+static bool xip_start_read(uint32_t index, uint32_t* dest, uint32_t count){
+    if (index + count > storage_xip_words){
+        return false;
+    }
+    dma_channel_config config = dma_channel_get_default_config(xip_dma_chan);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, true);
+    dma_channel_configure(xip_dma_chan, &config, dest, xip_words(index), count, true);
+    return true;
+}
+
+static bool xip_read_done(){
+    return !dma_channel_is_busy(xip_dma_chan);
+}
+
+static bool xip_read(uint32_t index, uint32_t* dest, uint32_t count){
+    if (!xip_start_read(index, dest, count)){
+        return false;
+    }
+    dma_channel_wait_for_finish_blocking(xip_dma_chan);
+    return true;
+}
+
+struct FlashOp{
+    uint32_t offset; // from the start of flash
+    const uint8_t* src; // nullptr to erase
+    uint32_t len;
+};
+
+static void run_flash_op(void* param){
+    const FlashOp* op = (const FlashOp*) param;
+    if (op->src == nullptr){
+        flash_range_erase(op->offset, op->len);
+    }
+    else{
+        flash_range_program(op->offset, op->src, op->len);
+    }
+}
+
+// XIP is off while flash is written, so the other core is parked and nothing can be reading it by DMA
+static bool flash_op(uint32_t offset, const uint8_t* src, uint32_t len){
+    while (!xip_read_done()){
+        tight_loop_contents();
+    }
+    FlashOp op = {offset, src, len};
+    return flash_safe_execute(run_flash_op, &op, UINT32_MAX) == PICO_OK;
+}
+
+static uint8_t sector_copy[FLASH_SECTOR_SIZE];
+
+static bool xip_write(uint32_t index, const uint32_t* src, uint32_t count){
+    if (index + count > storage_xip_words){
+        return false;
+    }
+    // a sector at a time, read back, changed and rewritten. files here are meant to be written once and
+    // played lots, unlike the log nothing spreads the wear out
+    const uint8_t* bytes = (const uint8_t*) src;
+    uint32_t offset = storage_xip_offset + index * 4;
+    uint32_t remaining = count * 4;
+    while (remaining > 0){
+        uint32_t sector = offset - (offset % FLASH_SECTOR_SIZE);
+        uint32_t within = offset - sector;
+        uint32_t chunk = FLASH_SECTOR_SIZE - within < remaining ? FLASH_SECTOR_SIZE - within : remaining;
+        memcpy(sector_copy, (const void*) (XIP_NOCACHE_NOALLOC_BASE + sector), FLASH_SECTOR_SIZE);
+        memcpy(&sector_copy[within], bytes, chunk);
+        if (!flash_op(sector, nullptr, FLASH_SECTOR_SIZE) or !flash_op(sector, sector_copy, FLASH_SECTOR_SIZE)){
+            return false;
+        }
+        bytes += chunk;
+        offset += chunk;
+        remaining -= chunk;
+    }
+    return true;
+}
+
+const StorageBackend xip_flash_backend = {"xip_flash", storage_xip_words, xip_read, xip_write, xip_start_read, xip_read_done};
+
+
+const uint8_t* flash_store_map(){
+    return (const uint8_t*) (XIP_NOCACHE_NOALLOC_BASE + flash_store_offset);
+}
+
+bool flash_store_erase(uint32_t offset){
+    return flash_op(flash_store_offset + offset, nullptr, flash_sector_bytes);
+}
+
+bool flash_store_program(uint32_t offset, const uint8_t* src){
+    return flash_op(flash_store_offset + offset, src, flash_page_bytes);
+}
+
+
+static void psram_command(uint8_t command, uint32_t address){
+    uint8_t header[4] = {command, (uint8_t) (address >> 16), (uint8_t) (address >> 8), (uint8_t) address};
+    gpio_put(PSRAM_CS, 0);
+    spi_write_blocking(PSRAM_SPI, header, 4);
+}
+
+static bool psram_read_done(){
+    if (psram_reading){
+        if (dma_channel_is_busy(psram_rx_chan)){
+            return false;
+        }
+        gpio_put(PSRAM_CS, 1);
+        psram_reading = false;
+    }
+    return true;
+}
+
+static bool psram_start_read(uint32_t index, uint32_t* dest, uint32_t count){
+    if (index + count > storage_psram_words){
+        return false;
+    }
+    while (!psram_read_done()){
+        tight_loop_contents();
+    }
+    psram_command(psram_cmd_read, index * 4);
+    // spi_write_blocking leaves junk in the RX FIFO
+    while (spi_is_readable(PSRAM_SPI)){
+        (void) spi_get_hw(PSRAM_SPI)->dr;
+    }
+
+    // one channel clocks out zeros, the other collects what comes back
+    static uint8_t zero = 0;
+    dma_channel_config tx_config = dma_channel_get_default_config(psram_tx_chan);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&tx_config, false);
+    channel_config_set_write_increment(&tx_config, false);
+    channel_config_set_dreq(&tx_config, spi_get_dreq(PSRAM_SPI, true));
+
+    dma_channel_config rx_config = dma_channel_get_default_config(psram_rx_chan);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, true);
+    channel_config_set_dreq(&rx_config, spi_get_dreq(PSRAM_SPI, false));
+
+    psram_reading = true;
+    dma_channel_configure(psram_rx_chan, &rx_config, dest, &spi_get_hw(PSRAM_SPI)->dr, count * 4, false);
+    dma_channel_configure(psram_tx_chan, &tx_config, &spi_get_hw(PSRAM_SPI)->dr, &zero, count * 4, false);
+    dma_start_channel_mask((1u << psram_rx_chan) | (1u << psram_tx_chan));
+    return true;
+}
+
+static bool psram_read(uint32_t index, uint32_t* dest, uint32_t count){
+    if (!psram_start_read(index, dest, count)){
+        return false;
+    }
+    while (!psram_read_done()){
+        tight_loop_contents();
+    }
+    return true;
+}
+
+static bool psram_write(uint32_t index, const uint32_t* src, uint32_t count){
+    if (index + count > storage_psram_words){
+        return false;
+    }
+    while (!psram_read_done()){
+        tight_loop_contents();
+    }
+    const uint8_t* bytes = (const uint8_t*) src;
+    uint32_t address = index * 4;
+    uint32_t remaining = count * 4;
+    while (remaining > 0){
+        uint32_t chunk = psram_page_bytes - (address % psram_page_bytes);
+        chunk = chunk < remaining ? chunk : remaining;
+        psram_command(psram_cmd_write, address);
+        spi_write_blocking(PSRAM_SPI, bytes, chunk);
+        gpio_put(PSRAM_CS, 1);
+        bytes += chunk;
+        address += chunk;
+        remaining -= chunk;
+    }
+    return true;
+}
+
+const StorageBackend psram_backend = {"psram", storage_psram_words, psram_read, psram_write, psram_start_read, psram_read_done};
+
+
+void setup_storage(){
+    // flash is written from core 1, core 0 has to be ready to be paused for it
+    flash_safe_execute_core_init();
+
+    xip_dma_chan = dma_claim_unused_channel(true);
+    psram_tx_chan = dma_claim_unused_channel(true);
+    psram_rx_chan = dma_claim_unused_channel(true);
+
+    spi_init(PSRAM_SPI, storage_psram_baud);
+    gpio_set_function(PSRAM_SCK, GPIO_FUNC_SPI);
+    gpio_set_function(PSRAM_MOSI, GPIO_FUNC_SPI);
+    gpio_set_function(PSRAM_MISO, GPIO_FUNC_SPI);
+    gpio_init(PSRAM_CS);
+    gpio_set_dir(PSRAM_CS, GPIO_OUT);
+    gpio_put(PSRAM_CS, 1);
+
+    // the chip needs 150 us after power up before it takes a reset
+    sleep_us(200);
+    uint8_t command = psram_cmd_reset_enable;
+    gpio_put(PSRAM_CS, 0);
+    spi_write_blocking(PSRAM_SPI, &command, 1);
+    gpio_put(PSRAM_CS, 1);
+    command = psram_cmd_reset;
+    gpio_put(PSRAM_CS, 0);
+    spi_write_blocking(PSRAM_SPI, &command, 1);
+    gpio_put(PSRAM_CS, 1);
+    sleep_us(1);
+}
@@ -0,0 +1,49 @@
+#include <cstdint>
+
+#include "uart_rx.h"
+#include "parsing.h"
+#include "constants.h"
+
+
+namespace UartRx{
+    alignas(uart_rx_ring_len) volatile uint8_t ring[uart_rx_ring_len];
+    volatile uint32_t read_index = 0;
+
+    volatile uint32_t bytes_received = 0;
+    volatile uint32_t overrun_count = 0;
+    volatile uint32_t overrun_bytes = 0;
+    volatile uint32_t high_water = 0;
+};
+
+using namespace UartRx;
+
+constexpr uint32_t ring_mask = uart_rx_ring_len - 1;
+
+
+uint32_t drain_rx_ring(uint32_t bytes_written){
+    if (bytes_written == 0){
+        return 0;
+    }
+
+    if (bytes_written > uart_rx_ring_len){
+        // the DMA has lapped us, only the newest ring worth of bytes is still there.
+        // the frame that was cut is thrown out by the CRC and the parser picks up at the next start
+        overrun_count = overrun_count + 1;
+        overrun_bytes = overrun_bytes + bytes_written - uart_rx_ring_len;
+        read_index = (read_index + bytes_written - uart_rx_ring_len) & ring_mask;
+        bytes_written = uart_rx_ring_len;
+    }
+    if (bytes_written > high_water){
+        high_water = bytes_written;
+    }
+
+    uint32_t index = read_index;
+    for (uint32_t i = 0; i < bytes_written; i++){
+        process_byte(ring[index]);
+        index = (index + 1) & ring_mask;
+    }
+    read_index = index;
+    bytes_received = bytes_received + bytes_written;
+
+    return bytes_written;
+}
@@ -0,0 +1,1593 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pico/time.h"
+#include "ArduinoJson-v7.4.2.h"
+#include "parsing.h"
+#include "playback.h"
+#include "comms.h"
+#include "crc16.h"
+#include "uart_rx.h"
+#include "frame_queue.h"
+#include "frame_buffer.h"
+#include "led_sequence.h"
+#include "parallel_output.h"
+#include "output_stage.h"
+#include "gamma.h"
+#include "effects.h"
+#include "storage.h"
+#include "flash_store.h"
+#include "arena.h"
+#include "light_hal.h"
+#include "host_shim.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static void send_command(CommandState id, const std::vector<uint32_t>& words){
+    for (uint8_t b : HostShim::build_frame(id, words)){
+        process_byte(b);
+    }
+}
+
+// run the oldest queued frame and decode the JSON reply
+static JsonDocument wait_for_response(){
+    JsonDocument result;
+    JsonDocument reply;
+    HostShim::uart_tx.clear();
+    if (handle_pending_command(result)){
+        deserializeJson(reply, HostShim::uart_tx);
+    }
+    return reply;
+}
+
+static void test_config_round_trip(){
+    HostShim::reset_state();
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::echo, 0x3456});
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(response["value"] == (uint32_t) ConfigIndex::echo);
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::running, 0x3456});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 42});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(light_config.led_count == 42);
+
+    send_command(CommandState::CONFIG_GET, {(uint32_t) ConfigIndex::led_count});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(response["value"] == 42);
+
+    send_command(CommandState::NOOP, {});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(Parsing::uart_parsing_state == ParseState::WAIT_START);
+}
+
+static void test_crc(){
+    HostShim::reset_state();
+
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    CHECK(crc16(check, sizeof(check)) == 0x29B1);
+
+    // flip one payload bit, the command must not run and the host gets BAD_CHECKSUM
+    std::vector<uint8_t> frame = HostShim::build_frame(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 42});
+    frame[10] ^= 0x01;
+    for (uint8_t b : frame){
+        process_byte(b);
+    }
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::BAD_CHECKSUM);
+    CHECK(response["value"] == (uint8_t) CommandState::CONFIG_SET);
+    CHECK(light_config.led_count == default_light_config.led_count);
+
+    // and the next good frame goes through
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 42});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(light_config.led_count == 42);
+}
+
+// stands in for the DMA, write bytes into the ring where it would and return how many landed.
+// every write here is drained straight away, so the DMA is always sitting at the read index
+static uint32_t dma_write(const std::vector<uint8_t>& bytes){
+    uint32_t write_index = UartRx::read_index;
+    for (uint8_t b : bytes){
+        UartRx::ring[write_index] = b;
+        write_index = (write_index + 1) % uart_rx_ring_len;
+    }
+    return bytes.size();
+}
+
+static void test_rx_ring(){
+    HostShim::reset_state();
+
+    std::vector<uint8_t> frame = HostShim::build_frame(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 42});
+    // the frame arrives split across two drains
+    std::vector<uint8_t> first(frame.begin(), frame.begin() + 5);
+    std::vector<uint8_t> second(frame.begin() + 5, frame.end());
+    CHECK(drain_rx_ring(dma_write(first)) == first.size());
+    CHECK(Parsing::uart_parsing_state == ParseState::READ_PAYLOAD);
+    drain_rx_ring(dma_write(second));
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(light_config.led_count == 42);
+
+    // wrap around the end of the ring a few times
+    for (uint32_t i = 0; i < 2*uart_rx_ring_len / frame.size(); i++){
+        drain_rx_ring(dma_write(frame));
+        response = wait_for_response();
+        CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    }
+    CHECK(UartRx::overrun_count == 0);
+
+    // lap the reader, the drain keeps the newest ring worth and counts what was lost
+    std::vector<uint8_t> junk(uart_rx_ring_len + 10, 0x00);
+    std::vector<uint8_t> burst(junk);
+    burst.insert(burst.end(), frame.begin(), frame.end());
+    CHECK(drain_rx_ring(dma_write(burst)) == uart_rx_ring_len);
+    CHECK(UartRx::overrun_count == 1);
+    CHECK(UartRx::overrun_bytes == burst.size() - uart_rx_ring_len);
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+}
+
+static void test_frame_queue(){
+    HostShim::reset_state();
+
+    // back to back frames queue up while nothing is being processed, in order
+    for (uint32_t i = 0; i < frame_queue_len; i++){
+        send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 10 + i});
+    }
+    CHECK(frame_queue_count() == frame_queue_len);
+    CHECK(FrameQueue::high_water == frame_queue_len);
+
+    // one more than fits is dropped, but the parser keeps up with the stream
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 99});
+    CHECK(FrameQueue::dropped == 1);
+    CHECK(Parsing::uart_parsing_state == ParseState::WAIT_START);
+
+    for (uint32_t i = 0; i < frame_queue_len; i++){
+        JsonDocument response = wait_for_response();
+        CHECK(response["error"] == (uint8_t) ProtoError::OK);
+        CHECK(light_config.led_count == 10 + i);
+    }
+    CHECK(frame_queue_count() == 0);
+    CHECK(wait_for_response().isNull());
+
+    // and with room again the next one goes through
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 42});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(light_config.led_count == 42);
+}
+
+// BATCH sub-command header word
+static uint32_t sub(CommandState id, uint8_t len){
+    return ((uint32_t) id << 24) | len;
+}
+
+static void test_batch(){
+    HostShim::reset_state();
+
+    send_command(CommandState::BATCH, {
+        sub(CommandState::CONFIG_SET, 2), (uint32_t) ConfigIndex::led_count, 42,
+        sub(CommandState::COLOR_SET, 3), 0, 7, 0x123456,
+        sub(CommandState::MULTI_COLOR_SET, 4), 0, 10, 0xAA, 0xBB,
+        sub(CommandState::NOOP, 0),
+        sub(CommandState::CONFIG_SET, 2), (uint32_t) ConfigIndex::running, 5, // out of range
+    });
+    JsonDocument response = wait_for_response();
+    CHECK(response["value"] == 1u << 4);
+    CHECK(response["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    CHECK(light_config.led_count == 42);
+    CHECK(led_frame[0][7] == 0x123456);
+    CHECK(led_frame[0][10] == 0xAA);
+    CHECK(led_frame[0][11] == 0xBB);
+    CHECK(led_frame[0][12] == 0);
+
+    // a length that runs off the end is rejected before anything runs
+    send_command(CommandState::BATCH, {
+        sub(CommandState::CONFIG_SET, 2), (uint32_t) ConfigIndex::led_count, 7,
+        sub(CommandState::COLOR_SET, 3), 0, 7,
+    });
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::BAD_PAYLOAD_LEN);
+    CHECK(light_config.led_count == 42);
+
+    send_command(CommandState::BATCH, {sub(CommandState::BATCH, 0)});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::BAD_COMMAND);
+    send_command(CommandState::BATCH, {sub(CommandState::NOOP, 0), sub(CommandState::FILE_LIST, 1), 0});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::BAD_COMMAND);
+    CHECK(response["value"] == 1);
+}
+
+static void test_binary_reply(){
+    HostShim::reset_state();
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::binary_reply, 1});
+    wait_for_response();
+    CHECK(light_config.binary_reply);
+
+    send_command(CommandState::CONFIG_GET, {(uint32_t) ConfigIndex::fps_ms});
+    wait_for_response();
+    const std::string& reply = HostShim::uart_tx;
+    CHECK(reply.size() == 1 + HEADER_LEN + 5 + CRC_LEN + 1);
+    CHECK(reply[0] == START_CONDITION);
+    CHECK(reply[1] == 0x01);
+    CHECK(reply[2] == (char) CommandState::CONFIG_GET);
+    CHECK(reply[3] == 5);
+    CHECK(reply[4] == (char) ProtoError::OK);
+    CHECK((uint8_t) reply[7] == (light_config.fps_ms >> 8));
+    CHECK((uint8_t) reply[8] == (light_config.fps_ms & 0xFF));
+    CHECK(reply.back() == END_CONDITION);
+    uint16_t crc = crc16((const uint8_t*) &reply[1], reply.size() - 1 - CRC_LEN - 1);
+    CHECK((uint8_t) reply[reply.size() - 3] == (crc >> 8));
+    CHECK((uint8_t) reply[reply.size() - 2] == (crc & 0xFF));
+
+    // FILE_GET carries all four values
+    send_command(CommandState::FILE_GET, {0});
+    wait_for_response();
+    CHECK(HostShim::uart_tx[3] == 1 + 4*4);
+
+    // more values than the buffer holds still gets a reply, the error on its own
+    JsonDocument result;
+    JsonArray values = result["value"].to<JsonArray>();
+    for (uint32_t i = 0; i < 4; i++){
+        values.add(i);
+    }
+    result["error"] = (uint8_t) ProtoError::OK;
+    uint8_t small[HEADER_LEN + 2 + 1 + 4*3 + CRC_LEN];
+    uint8_t length = serialize_binary_reply(result, (uint8_t) CommandState::FILE_GET, small, sizeof(small));
+    CHECK(length == HEADER_LEN + 2 + 1 + CRC_LEN);
+    CHECK(small[3] == 1);
+    CHECK(small[4] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    crc = crc16(&small[1], length - 1 - CRC_LEN - 1);
+    CHECK(small[5] == (crc >> 8) and small[6] == (crc & 0xFF));
+    CHECK(small[length - 1] == END_CONDITION);
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::binary_reply, 0});
+    wait_for_response();
+    send_command(CommandState::NOOP, {});
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+}
+
+static void send_chunk(uint16_t seq, const std::vector<uint32_t>& words){
+    for (uint8_t b : HostShim::build_stream_chunk(seq, words)){
+        process_byte(b);
+    }
+}
+
+static void test_stream_upload(){
+    HostShim::reset_state();
+
+    // 500 words in chunks of 100, acked every 2 chunks
+    std::vector<uint32_t> words(500);
+    for (uint32_t i = 0; i < words.size(); i++){
+        words[i] = (i << 8) | 1;
+    }
+    auto chunk = [&](uint16_t seq){
+        return std::vector<uint32_t>(words.begin() + seq*100, words.begin() + (seq + 1)*100);
+    };
+
+    // chunks before a STREAM_START are refused
+    send_chunk(0, chunk(0));
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::INVALID_PARAM);
+
+    send_command(CommandState::STREAM_START, {2, 100, (uint32_t) words.size(), 2});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(Stream::active);
+
+    send_chunk(0, chunk(0));
+    CHECK(frame_queue_count() == 0); // no ack until the window is full
+    send_chunk(1, chunk(1));
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(response["value"] == 2);
+
+    // a corrupt chunk is NAKed once, the one behind it is dropped quietly
+    std::vector<uint8_t> bad = HostShim::build_stream_chunk(2, chunk(2));
+    bad[20] ^= 0x01;
+    for (uint8_t b : bad){
+        process_byte(b);
+    }
+    send_chunk(3, chunk(3));
+    CHECK(frame_queue_count() == 1);
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::BAD_CHECKSUM);
+    CHECK(response["value"] == 2);
+
+    // an empty STREAM_ACK asks where to carry on from
+    send_command(CommandState::STREAM_ACK, {});
+    response = wait_for_response();
+    CHECK(response["value"] == 2);
+
+    // only the parser can say the file is complete, not the host, on its own or in a BATCH
+    send_command(CommandState::STREAM_ACK, {5, 0, 1});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::INVALID_PARAM);
+    send_command(CommandState::BATCH, {((uint32_t) CommandState::STREAM_ACK << 24) | 3, 5, 0, 1});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::INVALID_PARAM);
+    CHECK(files.end[2] == files.start[2]);
+    CHECK(Stream::active);
+
+    // go back and resend from there, the last chunk acks straight away and fills in the file
+    send_chunk(2, chunk(2));
+    send_chunk(3, chunk(3));
+    response = wait_for_response();
+    CHECK(response["value"] == 4);
+    // the block is handed out at STREAM_START, the file only covers it once every word is in
+    CHECK(files.end[2] == files.start[2]);
+    send_chunk(4, chunk(4));
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(response["value"] == 5);
+    CHECK(!Stream::active);
+    // the 100 asked for is ignored, first fit puts it straight after file 0
+    CHECK(files.start[2] == 2);
+    CHECK(files.end[2] == 501);
+    bool matches = true;
+    for (uint32_t i = 0; i < words.size(); i++){
+        matches = matches and data[files.start[2] + i] == words[i];
+    }
+    CHECK(matches);
+
+    // more than data[] holds is refused up front, and more than is free once file 0 is counted
+    send_command(CommandState::STREAM_START, {2, 0, max_data_len + 1, 1});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::STREAM_START, {2, 0, max_data_len - 1, 1});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::BUFFER_OVERFLOW);
+
+    // clearing the file half way through a chunk stops the stream before the block is zeroed,
+    // the rest of the chunk goes nowhere and gets a NAK
+    send_command(CommandState::STREAM_START, {3, 0, 200, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    uint32_t block = files.start[3];
+    send_command(CommandState::FILE_CLEAR, {3});
+    std::vector<uint8_t> split = HostShim::build_stream_chunk(0, chunk(0));
+    size_t half = split.size() / 2;
+    for (size_t i = 0; i < half; i++){
+        process_byte(split[i]);
+    }
+    CHECK(data[block] == words[0]);
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(!Stream::active);
+    for (size_t i = half; i < split.size(); i++){
+        process_byte(split[i]);
+    }
+    bool cleared = true;
+    for (uint32_t i = block; i < block + 200; i++){
+        cleared = cleared and data[i] == 0;
+    }
+    CHECK(cleared);
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::INVALID_PARAM);
+    CHECK(files.reserved[3] == 0 and files.end[3] == 0);
+
+    // the last ack dropped with the queue full, the empty STREAM_ACK the host times out into fills in the file
+    send_command(CommandState::STREAM_START, {4, 0, 100, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    for (uint32_t i = 0; i < frame_queue_len; i++){
+        send_command(CommandState::NOOP, {});
+    }
+    uint32_t dropped = FrameQueue::dropped;
+    send_chunk(0, chunk(0));
+    CHECK(FrameQueue::dropped == dropped + 1);
+    CHECK(!Stream::active);
+    for (uint32_t i = 0; i < frame_queue_len; i++){
+        wait_for_response();
+    }
+    CHECK(files.end[4] == files.start[4]);
+    send_command(CommandState::STREAM_ACK, {});
+    response = wait_for_response();
+    CHECK(response["value"] == 1);
+    CHECK(files.end[4] == files.start[4] + 99);
+    CHECK(files.action[4] == EndAction::REPEAT);
+    CHECK(data[files.start[4] + 99] == words[99]);
+
+    // cleared and given a new block before the last ack is run, the new block isn't taken for the upload
+    send_command(CommandState::STREAM_START, {5, 0, 100, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_CLEAR, {5});
+    send_command(CommandState::FILE_ALLOC, {5, 100});
+    send_chunk(0, chunk(0));
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.reserved[5] == 100);
+    CHECK(files.end[5] != files.start[5] + 99);
+}
+
+static void test_file_set_and_playback(){
+    HostShim::reset_state();
+    light_config.led_count = 3;
+
+    uint32_t red = (rgb_to_int(255, 0, 0) << 8) | 2;
+    uint32_t blue = (rgb_to_int(0, 0, 255) << 8) | 1;
+    // file id, starting location, update, colors...
+    send_command(CommandState::FILE_SET, {1, 10, 0, red, blue});
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    // the arena places SRAM files, the 10 only means anything for the other backends
+    CHECK(files.start[1] == 2);
+    CHECK(files.end[1] == 3);
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+
+    uint32_t expected[] = {red, red, blue};
+    uint32_t next_frame[max_led_len] = {0};
+    for (int frame = 0; frame < 2; frame++){
+        build_next_frame(next_frame);
+        for (int i = 0; i < 3; i++){
+            CHECK(next_frame[i] == expected[i]);
+        }
+        CHECK(playback_location == files.start[1]);
+    }
+}
+
+static void test_default_file_playback(){
+    HostShim::reset_state();
+
+    uint32_t next_frame[max_led_len] = {0};
+    build_next_frame(next_frame);
+    for (int i = 0; i < light_config.led_count; i++){
+        CHECK(next_frame[i] == (i < 5 ? data[0] : data[1]));
+    }
+    CHECK(playback_location == files.start[0]);
+}
+
+static void test_rle_kernel_matches_reference(){
+    HostShim::reset_state();
+    // two frames of 60 LEDs in runs of 1 to 7
+    light_config.led_count = 60;
+    std::vector<uint32_t> payload = {1, 0, 0};
+    for (int frame = 0; frame < 2; frame++){
+        uint32_t leds = 0;
+        for (uint32_t run = 1; leds < 60; run = run % 7 + 1){
+            uint32_t count = run < 60 - leds ? run : 60 - leds;
+            payload.push_back((rgb_to_int(leds, frame, run) << 8) | count);
+            leds += count;
+        }
+    }
+    send_command(CommandState::FILE_SET, payload);
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+
+    uint32_t kernel_frame[max_led_len] = {0};
+    uint32_t reference_frame[max_led_len] = {0};
+    for (int frame = 0; frame < 5; frame++){
+        uint32_t location = playback_location;
+        build_next_frame(kernel_frame);
+        uint32_t kernel_location = playback_location;
+        playback_location = location;
+        build_rle_frame_reference(reference_frame);
+        CHECK(playback_location == kernel_location);
+        CHECK(memcmp(kernel_frame, reference_frame, sizeof(kernel_frame)) == 0);
+    }
+}
+
+static void test_packed_formats(){
+    HostShim::reset_state();
+    // 16 color palette in file 2, then a PALETTE4 file of two words, 16 LEDs
+    std::vector<uint32_t> palette = {2, 0, 0};
+    for (uint32_t i = 0; i < 16; i++){
+        palette.push_back((rgb_to_int(i * 16, 0, 255 - i) << 8) | 1);
+    }
+    send_command(CommandState::FILE_SET, palette);
+    wait_for_response();
+    send_command(CommandState::FILE_SET, {1, 0, 0, 0x0123'4567, 0x89AB'CDEF});
+    wait_for_response();
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::PALETTE4, 2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+
+    send_command(CommandState::FILE_FORMAT, {1});
+    JsonDocument response = wait_for_response();
+    CHECK(response["value"][0] == (uint8_t) FileFormat::PALETTE4);
+    CHECK(response["value"][1] == 2);
+
+    // 10 LEDs a frame, so the second frame starts part way through the second word and wraps
+    light_config.led_count = 10;
+    uint32_t next_frame[max_led_len] = {0};
+    uint32_t index = 0;
+    for (int frame = 0; frame < 3; frame++){
+        build_next_frame(next_frame);
+        for (int i = 0; i < 10; i++){
+            CHECK(next_frame[i] == data[files.start[2] + index]);
+            index = (index + 1) % 16;
+        }
+    }
+    CHECK(playback_location == files.start[1] + 1);
+    CHECK(playback_slot == 6);
+
+    // RGB565, two LEDs a word, full scale stays full scale
+    send_command(CommandState::FILE_SET, {1, 0, 0, 0xF800'07E0, 0x001F'FFFF});
+    wait_for_response();
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::RGB565, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    light_config.led_count = 4;
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] >> 8 == rgb_to_int(255, 0, 0));
+    CHECK(next_frame[1] >> 8 == rgb_to_int(0, 255, 0));
+    CHECK(next_frame[2] >> 8 == rgb_to_int(0, 0, 255));
+    CHECK(next_frame[3] >> 8 == rgb_to_int(255, 255, 255));
+    CHECK(rgb565_to_int(0x8410) == rgb_to_int(0x84, 0x82, 0x84));
+    CHECK(playback_location == files.start[1]);
+
+    // a palette file too short for the format, one that isn't a file or an unknown format is refused
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::PALETTE8, 2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::PALETTE4, max_file_len});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::FILE_FORMAT, {1, file_format_count, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::FILE_FORMAT, {max_file_len, 0, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    CHECK(files.format[1] == FileFormat::RGB565);
+
+    // the palette file cleared out from under it, every LED is off whatever ends up at the start of data[]
+    send_command(CommandState::FILE_SET, {1, 0, 0, 0x0123'4567, 0x89AB'CDEF});
+    wait_for_response();
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::PALETTE4, 2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_CLEAR, {2});
+    wait_for_response();
+    CHECK(files.start[2] == 0 and files.reserved[2] == 0);
+    data[0] = (rgb_to_int(255, 255, 255) << 8) | 1;
+    light_config.led_count = 10;
+    build_next_frame(next_frame);
+    for (int i = 0; i < 10; i++){
+        CHECK(next_frame[i] == 0);
+    }
+}
+
+static void test_delta_format(){
+    HostShim::reset_state();
+    light_config.led_count = 4;
+    uint32_t red = (rgb_to_int(255, 0, 0) << 8) | 1;
+    uint32_t blue = (rgb_to_int(0, 0, 255) << 8) | 1;
+    // all red, then LED 2 goes blue, then a frame with no changes
+    send_command(CommandState::FILE_SET, {1, 20, 0,
+        1, (0 << 16) | 4, red,
+        1, (2 << 16) | 1, blue,
+        0
+    });
+    wait_for_response();
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::DELTA, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+
+    uint32_t expected[4][4] = {
+        {red, red, red, red},
+        {red, red, blue, red},
+        {red, red, blue, red},
+        {red, red, red, red}, // back to the start of the file, which starts from all off again
+    };
+    uint32_t next_frame[max_led_len] = {0};
+    for (int frame = 0; frame < 4; frame++){
+        build_next_frame(next_frame);
+        for (int i = 0; i < 4; i++){
+            CHECK(next_frame[i] == expected[frame][i]);
+        }
+    }
+    CHECK(playback_location == files.start[1] + 3);
+
+    // STOP holds the last frame once it runs out
+    files.action[1] = EndAction::STOP;
+    build_next_frame(next_frame);
+    build_next_frame(next_frame);
+    CHECK(playback_location == files.start[1] + 7);
+    build_next_frame(next_frame);
+    CHECK(next_frame[2] == blue);
+    CHECK(playback_location == files.start[1] + 7);
+}
+
+static void test_keyframe_format(){
+    HostShim::reset_state();
+    light_config.led_count = 4;
+    uint32_t red = (rgb_to_int(255, 0, 0) << 8) | 4;
+    uint32_t blue = (rgb_to_int(0, 0, 255) << 8) | 4;
+    // off at 0, red at 4, blue at 6
+    send_command(CommandState::FILE_SET, {1, 40, 0,
+        (0 << 16) | 1, 4,
+        (4 << 16) | 1, red,
+        (6 << 16) | 1, blue
+    });
+    wait_for_response();
+    send_command(CommandState::FILE_FORMAT, {1, (uint32_t) FileFormat::KEYFRAME, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+
+    uint32_t expected[] = {
+        rgb_to_int(0, 0, 0),
+        rgb_to_int(63, 0, 0),
+        rgb_to_int(127, 0, 0),
+        rgb_to_int(191, 0, 0),
+        rgb_to_int(255, 0, 0),
+        rgb_to_int(127, 0, 127),
+        rgb_to_int(0, 0, 255),
+        rgb_to_int(0, 0, 0), // round again
+        rgb_to_int(63, 0, 0),
+    };
+    uint32_t next_frame[max_led_len] = {0};
+    for (uint32_t color : expected){
+        build_next_frame(next_frame);
+        for (int i = 0; i < 4; i++){
+            CHECK(next_frame[i] >> 8 == color);
+        }
+    }
+
+    // STOP stays on the last keyframe
+    files.action[1] = EndAction::STOP;
+    for (int frame = 0; frame < 8; frame++){
+        build_next_frame(next_frame);
+    }
+    CHECK(next_frame[0] >> 8 == rgb_to_int(0, 0, 255));
+    CHECK(lerp_color(red, blue, 256) >> 8 == rgb_to_int(0, 0, 255));
+
+    // a keyframe claiming more entries than the file has left stops at the end of the file,
+    // nothing of file 2 straight after it turns up
+    uint32_t green = (rgb_to_int(0, 255, 0) << 8) | 4;
+    send_command(CommandState::FILE_SET, {3, 0, 0, (0 << 16) | 0xFFFF, (rgb_to_int(255, 0, 0) << 8) | 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_SET, {2, 0, 0, green, green});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.start[2] == files.end[3] + 1);
+    send_command(CommandState::FILE_FORMAT, {3, (uint32_t) FileFormat::KEYFRAME, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 3});
+    wait_for_response();
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] >> 8 == rgb_to_int(255, 0, 0));
+    for (int i = 1; i < 4; i++){
+        CHECK(next_frame[i] == 0);
+    }
+}
+
+static void test_effects(){
+    HostShim::reset_state();
+    light_config.led_count = 10;
+    // a green chase 2 LEDs wide moving one LED a frame
+    send_command(CommandState::EFFECT_SET, {1, (uint32_t) EffectId::CHASE, 0x100, 0x00FF00, 2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.action[1] == EndAction::FUNCTION);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+
+    uint32_t next_frame[max_led_len] = {0};
+    for (int frame = 0; frame < 4; frame++){
+        build_next_frame(next_frame);
+    }
+    for (int i = 0; i < 10; i++){
+        CHECK(next_frame[i] >> 8 == ((i == 3 or i == 2) ? 0x00FF00 : 0));
+    }
+
+    send_command(CommandState::EFFECT_SET, {1});
+    JsonDocument response = wait_for_response();
+    CHECK(response["value"][0] == (uint8_t) EffectId::CHASE);
+    CHECK(response["value"][3] == 2);
+
+    // a rainbow with no spread is all one hue, and starts at red
+    send_command(CommandState::EFFECT_SET, {1, (uint32_t) EffectId::RAINBOW, 0x100});
+    wait_for_response();
+    build_next_frame(next_frame);
+    for (int i = 0; i < 10; i++){
+        CHECK(next_frame[i] >> 8 == rgb_to_int(255, 0, 0));
+    }
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] >> 8 == hue_to_int(1));
+
+    // breathing half way up is a quarter brightness, it is squared
+    send_command(CommandState::EFFECT_SET, {1, (uint32_t) EffectId::BREATHING, 0x100 * 128, rgb_to_int(255, 0, 0)});
+    wait_for_response();
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] >> 8 == 0);
+    build_next_frame(next_frame);
+    CHECK(next_frame[9] >> 8 == rgb_to_int(63, 0, 0));
+
+    // fire starts cold, sparking every frame soon lights the bottom of the strip
+    send_command(CommandState::EFFECT_SET, {1, (uint32_t) EffectId::FIRE, 55, 255});
+    wait_for_response();
+    bool lit = false;
+    for (int frame = 0; frame < 50; frame++){
+        build_next_frame(next_frame);
+        lit = lit or next_frame[0] >> 8 != 0;
+    }
+    CHECK(lit);
+
+    // none of it touched data[]
+    for (uint32_t i = 2; i < max_data_len; i++){
+        CHECK(data[i] == 0);
+    }
+
+    send_command(CommandState::EFFECT_SET, {1, effect_count});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::EFFECT_SET, {max_file_len, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+}
+
+static void test_external_storage(){
+    HostShim::reset_state();
+    // the same 1500 word RLE file in data[] and PSRAM, long enough that the later frames
+    // are played out of the head and window rather than one run
+    std::vector<uint32_t> words;
+    for (uint32_t i = 0; i < 1500; i++){
+        words.push_back((rgb_to_int(i & 0xFF, i >> 8, 255 - (i & 0xFF)) << 8) | (i % 5 == 0 ? 6 : 1));
+    }
+    send_command(CommandState::FILE_ALLOC, {1, (uint32_t) words.size()});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    memcpy(&data[files.start[1]], words.data(), words.size() * sizeof(uint32_t));
+    files.end[1] = files.start[1] + 1499;
+    CHECK(HostShim::storage_load(StorageKind::PSRAM, 5000, words));
+    files.start[2] = 5000;
+    files.end[2] = 6499;
+    send_command(CommandState::FILE_STORAGE, {2, (uint32_t) StorageKind::PSRAM});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+
+    // 3000 LEDs in the file, 12 frames and round again
+    light_config.led_count = 250;
+    uint32_t sram_frame[max_led_len] = {0};
+    uint32_t psram_frame[max_led_len] = {0};
+    uint32_t sram_location = files.start[1];
+    playback_location = 5000;
+    for (int frame = 0; frame < 30; frame++){
+        current_file = 2;
+        build_next_frame(psram_frame);
+        uint32_t psram_location = playback_location;
+        current_file = 1;
+        playback_location = sram_location;
+        build_next_frame(sram_frame);
+        sram_location = playback_location;
+        CHECK(memcmp(sram_frame, psram_frame, sizeof(sram_frame)) == 0);
+        CHECK(psram_location - 5000 == sram_location - files.start[1]);
+        playback_location = psram_location;
+    }
+    // once the first frame was read in, everything else had been read ahead
+    CHECK(Prefetch::misses == 1);
+    CHECK(Prefetch::hits == 29);
+
+    // a palette file in PSRAM still looks its palette up in data[], grown to the 256 entries PALETTE8 can reach
+    send_command(CommandState::FILE_SET, {3, 0, 0, (rgb_to_int(1, 2, 3) << 8) | 1, (rgb_to_int(4, 5, 6) << 8) | 1});
+    wait_for_response();
+    send_command(CommandState::FILE_ALLOC, {3, palette_len(FileFormat::PALETTE8)});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    uint32_t palette = files.start[3];
+    send_command(CommandState::FILE_STORAGE, {4, (uint32_t) StorageKind::PSRAM});
+    wait_for_response();
+    send_command(CommandState::FILE_SET, {4, 2500, 0, 0x0100'0100});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(data[2500] == 0);
+    send_command(CommandState::FILE_FORMAT, {4, (uint32_t) FileFormat::PALETTE8, 3});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    current_file = 4;
+    playback_location = files.start[4];
+    light_config.led_count = 4;
+    build_next_frame(psram_frame);
+    CHECK(psram_frame[0] == data[palette + 1]);
+    CHECK(psram_frame[1] == data[palette]);
+    CHECK(psram_frame[2] == data[palette + 1]);
+    CHECK(psram_frame[3] == data[palette]);
+    CHECK(psram_frame[0] == ((rgb_to_int(4, 5, 6) << 8) | 1));
+
+    send_command(CommandState::FILE_STORAGE, {4});
+    JsonDocument response = wait_for_response();
+    CHECK(response["value"][0] == (uint8_t) StorageKind::PSRAM);
+    CHECK(response["value"][1] == storage_psram_words);
+
+    // XIP flash is written a sector at a time, streams still only go into data[]
+    send_command(CommandState::FILE_STORAGE, {5, (uint32_t) StorageKind::XIP_FLASH});
+    wait_for_response();
+    send_command(CommandState::FILE_SET, {5, 300, 0, (rgb_to_int(7, 8, 9) << 8) | 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    current_file = 5;
+    playback_location = files.start[5];
+    build_next_frame(psram_frame);
+    CHECK(psram_frame[0] == ((rgb_to_int(7, 8, 9) << 8) | 1));
+    send_command(CommandState::STREAM_START, {5, 0, 4, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::INVALID_PARAM);
+    send_command(CommandState::FILE_STORAGE, {5, storage_kind_count});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+
+    // a KEYFRAME file far enough in to be split, every fade is at the same place in the window.
+    // seeking part way into another fade decodes that one rather than keeping the last
+    std::vector<uint32_t> keyframes;
+    auto keyframe_color = [](uint32_t k){ return (rgb_to_int(k & 0xFF, 255 - (k & 0xFF), k >> 8) << 8) | 4; };
+    for (uint32_t k = 0; k < 700; k++){
+        keyframes.push_back((k * 4) << 16 | 1);
+        keyframes.push_back(keyframe_color(k));
+    }
+    CHECK(HostShim::storage_load(StorageKind::PSRAM, 8000, keyframes));
+    send_command(CommandState::FILE_STORAGE, {6, (uint32_t) StorageKind::PSRAM});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    files.start[6] = 8000;
+    files.end[6] = 8000 + keyframes.size() - 1;
+    send_command(CommandState::FILE_FORMAT, {6, (uint32_t) FileFormat::KEYFRAME, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    current_file = 6;
+    playback_location = 8000 + 2 * 300;
+    playback_slot = 0;
+    build_next_frame(psram_frame);
+    build_next_frame(psram_frame);
+    CHECK(psram_frame[0] >> 8 == lerp_color(keyframe_color(300), keyframe_color(301), 64) >> 8);
+    playback_location = 8000 + 2 * 400;
+    playback_slot = 1;
+    build_next_frame(psram_frame);
+    CHECK(psram_frame[0] >> 8 == lerp_color(keyframe_color(400), keyframe_color(401), 64) >> 8);
+}
+
+static void test_arena(){
+    HostShim::reset_state();
+    light_config.led_count = 1;
+    uint32_t a = (rgb_to_int(255, 0, 0) << 8) | 1;
+    uint32_t b = (rgb_to_int(0, 255, 0) << 8) | 1;
+    uint32_t c = (rgb_to_int(0, 0, 255) << 8) | 1;
+    // first fit, one after the other behind file 0
+    send_command(CommandState::FILE_SET, {1, 0, 0, a, b, c, a});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_SET, {2, 0, 0, b, b, b});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_SET, {3, 0, 0, c, a});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.start[1] == 2 and files.end[1] == 5);
+    CHECK(files.start[2] == 6 and files.end[2] == 8);
+    CHECK(files.start[3] == 9 and files.end[3] == 10);
+    CHECK(!arena_compact_step());
+
+    // clearing file 2 leaves a hole below file 3
+    send_command(CommandState::FILE_CLEAR, {2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.reserved[2] == 0);
+    CHECK(arena_free_words() == max_data_len - 8);
+    CHECK(arena_largest_free() == max_data_len - 11);
+
+    // compaction moves file 3 down under playback, it carries on from the same place
+    current_file = 3;
+    playback_location = files.start[3];
+    uint32_t next_frame[max_led_len] = {0};
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] == c);
+    CHECK(arena_compact_step());
+    CHECK(!arena_compact_step());
+    CHECK(files.start[3] == 6 and files.end[3] == 7);
+    CHECK(playback_location == 7);
+    CHECK(Arena::moves == 1 and Arena::words_moved == 2);
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] == a);
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] == c);
+
+    // appending to file 1 with file 3 straight after it moves file 1 somewhere it fits
+    send_command(CommandState::FILE_SET, {1, 0, 1, b});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.start[1] == 8 and files.end[1] == 12);
+    uint32_t expected[] = {a, b, c, a, b};
+    for (uint32_t i = 0; i < 5; i++){
+        CHECK(data[files.start[1] + i] == expected[i]);
+    }
+
+    // room made up front comes back with where it went
+    send_command(CommandState::FILE_ALLOC, {4, 100});
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(response["value"] == (uint32_t) files.start[4]);
+    CHECK(files.reserved[4] == 100);
+
+    // more than is free is refused and nothing moves
+    send_command(CommandState::FILE_ALLOC, {5, max_data_len});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::BUFFER_OVERFLOW);
+    CHECK(files.reserved[5] == 0);
+    CHECK(Arena::moves == 2);
+
+    // all of what is free only fits once the hole file 1 left is closed up
+    uint32_t free_words = arena_free_words();
+    CHECK(arena_largest_free() < free_words);
+    send_command(CommandState::FILE_ALLOC, {5, free_words});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(arena_free_words() == 0);
+    for (uint32_t i = 0; i < 5; i++){
+        CHECK(data[files.start[1] + i] == expected[i]);
+    }
+    CHECK(data[files.start[3]] == c and data[files.start[3] + 1] == a);
+
+    // a block being streamed into stays put, so compaction leaves a gap either side of it
+    HostShim::reset_state();
+    send_command(CommandState::FILE_ALLOC, {1, 1000});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::STREAM_START, {2, 0, 1000, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_ALLOC, {3, 500});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.start[2] == 1002 and files.start[3] == 2002);
+    send_command(CommandState::FILE_CLEAR, {1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    // 1498 free all told, but 1000 below the stream and 498 above it is the best compaction can do
+    send_command(CommandState::FILE_ALLOC, {4, 1200});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::BUFFER_OVERFLOW);
+    CHECK(files.reserved[4] == 0 and files.start[4] == 0);
+    CHECK(files.start[2] == 1002 and files.reserved[2] == 1000);
+    CHECK(Stream::active);
+    send_command(CommandState::FILE_ALLOC, {4, 1000});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(files.start[4] == 2);
+
+    // growing the file being streamed into moves it, so the stream is stopped first and its chunks
+    // are refused rather than landing in the block it left
+    send_command(CommandState::FILE_CLEAR, {4});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FILE_ALLOC, {2, 1100});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(!Stream::active);
+    CHECK(files.start[2] == 2 and files.reserved[2] == 1100);
+    send_chunk(0, std::vector<uint32_t>(100, 0xFFFF'FF01));
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::INVALID_PARAM);
+    CHECK(data[2] != 0xFFFF'FF01 and data[1002] != 0xFFFF'FF01);
+}
+
+static void test_file_table(){
+    HostShim::reset_state();
+    flash_store_format();
+    // only file 0 is taken to start with, the rest come out lowest first
+    CHECK(file_table_count() == 1);
+    send_command(CommandState::FILE_NEW, {});
+    JsonDocument response = wait_for_response();
+    CHECK(response["error"] == (uint8_t) ProtoError::OK);
+    CHECK(response["value"] == 1);
+    CHECK(file_table_in_use(1));
+
+    // every id a byte can hold is a real entry, one past it is refused rather than written off the end
+    uint32_t color = (rgb_to_int(1, 2, 3) << 8) | 1;
+    send_command(CommandState::FILE_SET, {max_file_len - 1, 0, 0, color, color});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(file_table_in_use(max_file_len - 1));
+    send_command(CommandState::FILE_SET, {max_file_len, 0, 0, color});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::FILE_GET, {max_file_len});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, max_file_len});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::EFFECT_SET, {7, (uint32_t) EffectId::RAINBOW, 0x100});
+    wait_for_response();
+
+    // a page of the table in one long reply, whatever binary_reply is set to
+    send_command(CommandState::FILE_LIST, {});
+    JsonDocument result;
+    HostShim::uart_tx.clear();
+    CHECK(handle_pending_command(result));
+    const std::string& reply = HostShim::uart_tx;
+    uint16_t reply_len = 1 + 4 + 12*4;
+    CHECK(reply.size() == (size_t) (1 + 4 + reply_len + CRC_LEN + 1));
+    CHECK(reply[0] == STREAM_START_CONDITION);
+    CHECK(reply[1] == 0x01);
+    CHECK(reply[2] == (char) CommandState::FILE_LIST);
+    CHECK((uint8_t) reply[3] == reply_len >> 8 and (uint8_t) reply[4] == (reply_len & 0xFF));
+    CHECK(reply[5] == (char) ProtoError::OK);
+    auto word = [&reply](uint32_t index){
+        const uint8_t* b = (const uint8_t*) &reply[index];
+        return (uint32_t) ((b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]);
+    };
+    // all of it fits, there is nothing to ask for next
+    CHECK(word(6) == max_file_len);
+    uint32_t ids[] = {0, 1, 7, max_file_len - 1};
+    for (uint32_t i = 0; i < 4; i++){
+        CHECK(word(10 + 12*i) >> 24 == ids[i]);
+        CHECK(word(14 + 12*i) == files.start[ids[i]]);
+        CHECK(word(18 + 12*i) == files.end[ids[i]]);
+    }
+    CHECK((word(10 + 12*2) >> 16 & 0xFF) == (uint8_t) EndAction::FUNCTION);
+
+    uint16_t crc = crc16((const uint8_t*) &reply[1], reply.size() - 1 - CRC_LEN - 1);
+    CHECK((uint8_t) reply[reply.size() - 3] == (crc >> 8));
+    CHECK((uint8_t) reply[reply.size() - 2] == (crc & 0xFF));
+    CHECK(reply.back() == END_CONDITION);
+
+    // more than a page, the host carries on from Next Id
+    for (uint32_t file_id = 20; file_id < 40; file_id++){
+        send_command(CommandState::FILE_SET, {file_id, 0, 0, color});
+        wait_for_response();
+    }
+    send_command(CommandState::FILE_LIST, {8});
+    HostShim::uart_tx.clear();
+    CHECK(handle_pending_command(result));
+    CHECK(reply.size() == 1 + 4 + 1 + 4 + 12*file_list_page_len + CRC_LEN + 1);
+    CHECK(word(10) >> 24 == 20);
+    CHECK(word(10 + 12*(file_list_page_len - 1)) >> 24 == 35);
+    CHECK(word(6) == 36);
+    send_command(CommandState::FILE_LIST, {36});
+    HostShim::uart_tx.clear();
+    CHECK(handle_pending_command(result));
+    CHECK(reply.size() == 1 + 4 + 1 + 4 + 12*5 + CRC_LEN + 1);
+    CHECK(word(6) == max_file_len);
+    CHECK(word(10 + 12*4) >> 24 == max_file_len - 1);
+    send_command(CommandState::FILE_LIST, {max_file_len});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    for (uint32_t file_id = 20; file_id < 40; file_id++){
+        send_command(CommandState::FILE_CLEAR, {file_id});
+        wait_for_response();
+    }
+
+    // clearing puts the id back, it is the next one handed out
+    send_command(CommandState::FILE_CLEAR, {1});
+    wait_for_response();
+    CHECK(!file_table_in_use(1));
+    send_command(CommandState::FILE_NEW, {});
+    CHECK(wait_for_response()["value"] == 1);
+    send_command(CommandState::FILE_CLEAR, {1});
+    wait_for_response();
+
+    // which ids are taken survives a power cycle, freed ones included
+    CHECK(flash_store_flush());
+    send_command(CommandState::FILE_CLEAR, {7});
+    wait_for_response();
+    CHECK(flash_store_flush());
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(file_table_count() == 2);
+    CHECK(file_table_in_use(0) and file_table_in_use(max_file_len - 1));
+    CHECK(!file_table_in_use(1) and !file_table_in_use(7));
+    CHECK(files.action[7] == EndAction::REPEAT);
+    CHECK(data[files.start[max_file_len - 1]] == color);
+
+    // and once every id is taken there are none left to hand out
+    for (uint16_t file_id = 0; file_id < max_file_len; file_id++){
+        file_table_use(file_id);
+    }
+    send_command(CommandState::FILE_NEW, {});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::BUFFER_OVERFLOW);
+    flash_store_format();
+}
+
+// a CONFIG record the way firmware with some other layout would have put it at the end of the log
+static void write_config_record(uint8_t layout, uint16_t led_count){
+    uint32_t page[flash_page_bytes / 4] = {0};
+    page[0] = flash_record_magic;
+    page[1] = FlashStore::head;
+    page[2] = ((uint32_t) FlashRecord::CONFIG << 24) | ((uint32_t) layout << 8) | ((sizeof(Animation_Config) + 1 + 3) / 4);
+    Animation_Config config;
+    memcpy(&config, (const void*) &light_config, sizeof(config));
+    config.led_count = led_count;
+    memcpy(&page[flash_record_header_words], &config, sizeof(config));
+    const uint8_t* bytes = (const uint8_t*) page;
+    uint16_t crc = CRC16_INIT;
+    for (uint32_t i = 4; i < flash_page_bytes; i++){
+        if (i < 16 or i >= flash_record_header_words * 4){
+            crc = crc16_update(crc, bytes[i]);
+        }
+    }
+    page[4] = crc;
+    uint32_t position = FlashStore::head % flash_store_pages;
+    if (position % flash_pages_per_sector == 0){
+        flash_store_erase(position * flash_page_bytes);
+    }
+    flash_store_program(position * flash_page_bytes, bytes);
+}
+
+static void test_flash_store(){
+    HostShim::reset_state();
+    flash_store_format();
+    // nothing saved, boot falls back to default_file_0
+    CHECK(!flash_store_load());
+
+    uint32_t red = (rgb_to_int(255, 0, 0) << 8) | 2;
+    uint32_t green = (rgb_to_int(0, 255, 0) << 8) | 3;
+    uint32_t blue = (rgb_to_int(0, 0, 255) << 8) | 5;
+    send_command(CommandState::FILE_SET, {1, 40, 0, red, green, blue});
+    wait_for_response();
+    send_command(CommandState::EFFECT_SET, {2, (uint32_t) EffectId::BREATHING, 0x100, 0xFF0000});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 10});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+    CHECK(flash_store_flush());
+    // the first write is a whole checkpoint of the three files in use, data[] only has anything in its first chunk
+    CHECK(file_table_count() == 3);
+    CHECK(FlashStore::pages_written == 2 + 3 + 1);
+    uint32_t start = files.start[1];
+
+    // power cycle
+    HostShim::reset_state();
+    CHECK(files.end[1] == 0);
+    CHECK(flash_store_load());
+    CHECK(data[start] == red);
+    CHECK(data[start + 2] == blue);
+    CHECK(files.start[1] == start);
+    CHECK(files.end[1] == start + 2);
+    CHECK(files.reserved[1] == 3);
+    CHECK(files.action[2] == EndAction::FUNCTION);
+    CHECK(Effects::settings[2].id == EffectId::BREATHING);
+    CHECK(Effects::settings[2].params[1] == 0xFF0000);
+    CHECK(light_config.led_count == 10);
+    CHECK(current_file == 1);
+    CHECK(playback_location == start);
+    uint32_t next_frame[max_led_len] = {0};
+    build_next_frame(next_frame);
+    CHECK(next_frame[0] == red and next_frame[2] == green and next_frame[5] == blue);
+
+    // after that only what changed is written, the file entry and the one chunk of data[]
+    send_command(CommandState::FILE_SET, {1, 40, 1, red});
+    wait_for_response();
+    CHECK(flash_store_flush());
+    CHECK(FlashStore::pages_written == 2);
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(files.end[1] == start + 3);
+    CHECK(data[start + 3] == red);
+
+    // a CONFIG_SET that fails or sets what is already there isn't worth a write
+    uint32_t written = FlashStore::pages_written;
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 10});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::fps_ms, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(flash_store_flush());
+    CHECK(FlashStore::pages_written == written);
+
+    // the strip layout isn't saved, the strips come back split evenly. led_frame isn't either,
+    // so the DMA sequence would only play blank frames and is left off
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::strip_count, 2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::dma_sequence, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(flash_store_flush());
+    ParallelOutput::strips[0] = {0, 0};
+    ParallelOutput::strips[1] = {0, 0};
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(light_config.strip_count == 2);
+    CHECK(ParallelOutput::strips[0].led_count == 5);
+    CHECK(ParallelOutput::strips[1].start == 5 and ParallelOutput::strips[1].led_count == 5);
+    CHECK(!light_config.dma_sequence);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::strip_count, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(flash_store_flush());
+
+    // a CONFIG record laid out some other way is skipped, one laid out this way isn't
+    write_config_record(flash_record_layout + 1, 77);
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(light_config.led_count == 10);
+    write_config_record(flash_record_layout, 77);
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(light_config.led_count == 77);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 10});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(flash_store_flush());
+
+    // many times round the log, new checkpoints keep everything that is needed ahead of the erases
+    for (uint32_t i = 0; i < 3000; i++){
+        send_command(CommandState::FILE_SET, {1, 40, 0, i, i + 1, i + 2});
+        wait_for_response();
+        CHECK(flash_store_flush());
+    }
+    CHECK(FlashStore::sectors_erased > 4 * flash_store_pages / flash_pages_per_sector);
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(data[start] == 2999);
+    CHECK(data[start + 2] == 3001);
+    CHECK(files.end[1] == start + 2);
+    CHECK(light_config.led_count == 10);
+    CHECK(Effects::settings[2].id == EffectId::BREATHING);
+
+    // a poll only writes a few pages, a checkpoint carries on over the next polls without waiting again
+    flash_store_format();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 11});
+    wait_for_response();
+    written = FlashStore::pages_written;
+    flash_store_poll();
+    CHECK(FlashStore::pages_written == written);
+    uint32_t idle = time_us_32();
+    while (time_us_32() - idle <= flash_store_idle_us){
+        tight_loop_contents();
+    }
+    flash_store_poll();
+    CHECK(FlashStore::pages_written == written + flash_store_pages_per_poll);
+    for (uint8_t i = 0; i < 4; i++){
+        flash_store_poll();
+    }
+    CHECK(FlashStore::pages_written == written + 2 + 3 + 1);
+    CHECK(FlashStore::poll_us > 0);
+    HostShim::reset_state();
+    CHECK(flash_store_load());
+    CHECK(light_config.led_count == 11);
+    CHECK(data[start + 2] == 3001);
+
+    // left empty for anything after
+    flash_store_format();
+}
+
+static void test_frame_buffer(){
+    HostShim::reset_state();
+    light_config.led_count = 3;
+    uint32_t color = (rgb_to_int(0, 255, 0) << 8) | 3;
+    send_command(CommandState::FILE_SET, {1, 0, 0, color});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+
+    // nothing rendered yet, the IRQ keeps sending the front buffer
+    uint32_t* front = frame_buffer_swap();
+    CHECK(front == FrameBuffer::buffers[0]);
+    CHECK(FrameBuffer::repeated == 1);
+
+    // core 1 renders into the back buffer once, then waits for the swap
+    CHECK(render_pending_frame());
+    CHECK(!render_pending_frame());
+    CHECK(FrameBuffer::buffers[1][0] == color);
+    CHECK(FrameBuffer::buffers[1][2] == color);
+
+    front = frame_buffer_swap();
+    CHECK(front == FrameBuffer::buffers[1]);
+    CHECK(FrameBuffer::repeated == 1);
+
+    // and the old front is handed back
+    CHECK(render_pending_frame());
+    CHECK(FrameBuffer::buffers[0][0] == color);
+    CHECK(frame_buffer_swap() == FrameBuffer::buffers[0]);
+
+    // led_count past the buffer only renders what fits
+    light_config.led_count = max_led_len + 10;
+    CHECK(render_pending_frame());
+
+    // stopped, core 1 renders nothing and the same frame going out again isn't a repeat
+    CHECK(frame_buffer_swap() == FrameBuffer::buffers[1]);
+    uint32_t repeated = FrameBuffer::repeated;
+    light_config.running = false;
+    frame_buffer_swap();
+    frame_buffer_swap();
+    CHECK(FrameBuffer::repeated == repeated);
+    light_config.running = true;
+    frame_buffer_swap();
+    CHECK(FrameBuffer::repeated == repeated + 1);
+}
+
+// RP2040 DMA CTRL bits the sequence chain relies on
+constexpr uint32_t dma_ctrl_en = 1u << 0;
+constexpr uint32_t dma_ctrl_irq_quiet = 1u << 21;
+
+// LedSequence::blocks as the control channel writes them into the LED channel's alias 1 registers, a block
+// at a time. a count of 0 is a null trigger, which only raises the IRQ if CTRL still has IRQ_QUIET and EN.
+// returns how many blocks ran before it
+static uint32_t run_sequence_chain(bool& end_irq){
+    uint32_t ctrl = 0;
+    end_irq = false;
+    for (uint32_t i = 0; i < max_sequence_blocks; i++){
+        const DmaControlBlock& block = LedSequence::blocks[i];
+        ctrl = block.ctrl;
+        if (block.transfer_count == 0){
+            end_irq = (ctrl & dma_ctrl_irq_quiet) and (ctrl & dma_ctrl_en);
+            return i;
+        }
+        // otherwise it runs and chains back to the control channel for the next block
+    }
+    return max_sequence_blocks;
+}
+
+static void test_led_sequence(){
+    HostShim::reset_state();
+    volatile uint32_t fifo = 0;
+
+    // 100 LEDs take 2.4 ms, the gap pads them out to 50 ms
+    uint32_t count = build_led_sequence(0x11, 0x22, &fifo, 3, 100, 50);
+    CHECK(count == 7);
+    for (uint32_t frame = 0; frame < 3; frame++){
+        const DmaControlBlock& block = LedSequence::blocks[2*frame];
+        CHECK(block.read_addr == led_frame[frame]);
+        CHECK(block.write_addr == &fifo);
+        CHECK(block.transfer_count == 100);
+        CHECK(block.ctrl == 0x11);
+        const DmaControlBlock& gap = LedSequence::blocks[2*frame + 1];
+        CHECK(gap.transfer_count == (50000 - 100*ws2811_us_per_led) / sequence_gap_tick_us);
+        CHECK(gap.ctrl == 0x22);
+    }
+    // the null block that ends the chain, CTRL left as it was so the null trigger raises the IRQ
+    CHECK(LedSequence::blocks[6].read_addr == nullptr);
+    CHECK(LedSequence::blocks[6].transfer_count == 0);
+    CHECK(LedSequence::blocks[6].ctrl == 0x11);
+
+    // a frame rate faster than the strip can go still leaves the latch gap
+    CHECK(sequence_gap_ticks(max_led_len, 1) == ws2811_latch_us / sequence_gap_tick_us);
+
+    // frames and LEDs past the end of led_frame are not sent
+    count = build_led_sequence(0x11, 0x22, &fifo, max_frame_len + 5, max_led_len + 5, 50);
+    CHECK(count == max_sequence_blocks);
+    CHECK(LedSequence::blocks[0].transfer_count == max_led_len);
+
+    // and the frame ids are checked against led_frame too
+    send_command(CommandState::COLOR_SET, {max_frame_len, 0, 0x123456});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::COLOR_SET, {0, max_led_len, 0x123456});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::frame_count, 1000});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::led_count, 1000});
+    wait_for_response();
+    send_command(CommandState::COLOR_GET, {max_frame_len, 0});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::COLOR_GET, {0, max_led_len});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::COLOR_GET, {max_frame_len - 1, max_led_len - 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::dma_sequence, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(light_config.dma_sequence);
+
+    // a frame with its own duration gets its own gap, the rest stay at fps_ms
+    send_command(CommandState::FRAME_DURATION, {1, 200});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::FRAME_DURATION, {1});
+    CHECK(wait_for_response()["value"] == 200);
+    build_led_sequence(0x11, 0x22, &fifo, 3, 100, 50);
+    CHECK(LedSequence::blocks[1].transfer_count == (50000 - 100*ws2811_us_per_led) / sequence_gap_tick_us);
+    CHECK(LedSequence::blocks[3].transfer_count == (200000 - 100*ws2811_us_per_led) / sequence_gap_tick_us);
+    CHECK(LedSequence::blocks[5].transfer_count == (50000 - 100*ws2811_us_per_led) / sequence_gap_tick_us);
+    CHECK(sequence_frame_ms(1, 50) == 200);
+    CHECK(sequence_frame_ms(2, 50) == 50);
+
+    send_command(CommandState::FRAME_DURATION, {max_frame_len, 10});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::FRAME_DURATION, {0, 0x10000});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+
+    // run the chain the way the control channel does, through to the end IRQ and round again
+    uint32_t frame_ctrl = dma_ctrl_en | dma_ctrl_irq_quiet | 0x11;
+    uint32_t gap_ctrl = dma_ctrl_en | dma_ctrl_irq_quiet | 0x22;
+    count = build_led_sequence(frame_ctrl, gap_ctrl, &fifo, 3, 100, 50);
+    bool end_irq = false;
+    CHECK(run_sequence_chain(end_irq) == count - 1);
+    CHECK(end_irq);
+    LedSequence::running = true;
+    uint32_t loops = LedSequence::loops;
+    CHECK(led_sequence_end());
+    CHECK(LedSequence::loops == loops + 1);
+    // stopped in between, the IRQ still counts the loop but nothing is started again
+    LedSequence::running = false;
+    CHECK(!led_sequence_end());
+    CHECK(LedSequence::loops == loops + 2);
+}
+
+// what strip s sees for LED led, read back out of the transposed stream
+static uint32_t untranspose(const uint32_t* wire, uint8_t strip, uint16_t led){
+    uint32_t color = 0;
+    for (uint8_t bit = 0; bit < ws2811_bits_per_led; bit++){
+        uint32_t word = wire[led*parallel_words_per_led + bit/4];
+        uint8_t slice = word >> (24 - 8*(bit % 4));
+        color = (color << 1) | ((slice >> strip) & 1);
+    }
+    return color;
+}
+
+static void test_parallel_output(){
+    HostShim::reset_state();
+    light_config.led_count = 10;
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::strip_count, 3});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(ParallelOutput::strips[0].led_count == 4);
+    CHECK(ParallelOutput::strips[1].start == 4);
+    CHECK(ParallelOutput::strips[2].led_count == 2);
+    CHECK(ParallelOutput::strips[3].led_count == 0);
+
+    // strip 2 shows a reversed copy somewhere else in the frame
+    send_command(CommandState::STRIP_SET, {2, 20, 3});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    CHECK(parallel_strip_len(3) == 4);
+
+    uint32_t frame[max_led_len] = {0};
+    for (int i = 0; i < 30; i++){
+        frame[i] = (rgb_to_int(i * 8, 255 - i, i ^ 0x5A) << 8) | 1;
+    }
+    uint32_t wire[max_led_len * parallel_words_per_led];
+    CHECK(transpose_strips(frame, 3, wire) == 4 * parallel_words_per_led);
+    for (uint16_t led = 0; led < 4; led++){
+        CHECK(untranspose(wire, 0, led) == frame[led] >> 8);
+        CHECK(untranspose(wire, 1, led) == frame[4 + led] >> 8);
+        // past the end of a shorter strip is black
+        CHECK(untranspose(wire, 2, led) == (led < 3 ? frame[20 + led] >> 8 : 0));
+        CHECK(untranspose(wire, 3, led) == 0);
+    }
+
+    // the SWAR kernel against the bit at a time one, every strip count and uneven strips
+    uint32_t seed = 12345;
+    for (int i = 0; i < max_led_len; i++){
+        seed = seed * 1103515245 + 12345;
+        frame[i] = seed;
+    }
+    uint32_t reference[max_led_len * parallel_words_per_led];
+    bool matches = true;
+    for (uint8_t strip_count = 1; strip_count <= max_strips; strip_count++){
+        layout_strips_evenly(strip_count, max_led_len - strip_count);
+        uint32_t words = transpose_strips(frame, strip_count, wire);
+        matches = matches and words == transpose_strips_reference(frame, strip_count, reference);
+        for (uint32_t i = 0; i < words; i++){
+            matches = matches and wire[i] == reference[i];
+        }
+    }
+    CHECK(matches);
+
+    send_command(CommandState::STRIP_SET, {max_strips, 0, 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::STRIP_SET, {0, max_led_len - 1, 2});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::strip_count, max_strips + 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    // more than the board has pins for would be transposed and then never sent
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::strip_count, WS2811_PARALLEL_PINS + 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::strip_count, WS2811_PARALLEL_PINS});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+}
+
+static void test_output_stage(){
+    HostShim::reset_state();
+    uint32_t pixel = (rgb_to_int(255, 128, 10) << 8) | 7;
+
+    // untouched by default
+    uint32_t frame[1] = {pixel};
+    apply_output_stage(frame, 1);
+    CHECK(frame[0] == pixel);
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::brightness, 128});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    frame[0] = pixel;
+    apply_output_stage(frame, 1);
+    CHECK(frame[0] == ((rgb_to_int(128, 64, 5) << 8) | 7));
+
+    // green off, blue halved, then sent GRB
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::brightness, 255});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::channel_gain, 0xFF0080});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::color_order, (uint32_t) ColorOrder::GRB});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    frame[0] = pixel;
+    apply_output_stage(frame, 1);
+    CHECK(frame[0] == ((rgb_to_int(0, 255, 5) << 8) | 7));
+
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::color_order, 6});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::channel_gain, 0x1000000});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+
+    // and it is part of rendering a frame
+    light_config.led_count = 3;
+    CHECK(render_pending_frame());
+    CHECK(FrameBuffer::buffers[1][0] >> 8 == rgb_to_int(0, 168, 10));
+
+    // gamma 2.2 on red only
+    HostShim::reset_state();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::gamma, (uint32_t) GammaCurve::GAMMA_2_2 << 16});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    frame[0] = (rgb_to_int(128, 128, 255) << 8);
+    apply_output_stage(frame, 1);
+    CHECK(frame[0] >> 24 == (gamma_tables[(uint8_t) GammaCurve::GAMMA_2_2].entries[128] + 0x80) >> 8);
+    CHECK(frame[0] >> 8 == rgb_to_int(56, 128, 255));
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::gamma, gamma_curve_count});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+
+    // with dither on, 8 frames average out to the 8.8 value
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::dither, (uint32_t) DitherMode::ORDERED});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    bool averages = true;
+    for (uint32_t value = 0; value < 256; value += 7){
+        uint32_t sum = 0;
+        for (int refresh = 0; refresh < 8; refresh++){
+            frame[0] = value << 24;
+            apply_output_stage(frame, 1);
+            sum += frame[0] >> 24;
+        }
+        int32_t error = (int32_t) (sum << 8) - 8 * (int32_t) OutputStage::lut[0][value];
+        averages = averages and error <= 256 and error >= -256;
+    }
+    CHECK(averages);
+}
+
+static void test_temporal_dither(){
+    HostShim::reset_state();
+    light_config.led_count = 2;
+    // two content frames of one entry each, so playback_location shows which one was last built
+    uint32_t dim = (rgb_to_int(3, 1, 0) << 8) | 2;
+    send_command(CommandState::FILE_SET, {1, 0, 0, dim, dim});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::current_file, 1});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::gamma, 0x030303});
+    wait_for_response();
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::dither, (uint32_t) DitherMode::TEMPORAL});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::refreshes_per_frame, 4});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OK);
+    send_command(CommandState::CONFIG_SET, {(uint32_t) ConfigIndex::refreshes_per_frame, max_refreshes_per_frame + 1});
+    CHECK(wait_for_response()["error"] == (uint8_t) ProtoError::OUT_OF_RANGE);
+
+    // red 3 through gamma 2.2 is well under one step, with the error carried the output averages out to it
+    uint32_t sum = 0;
+    const uint32_t refreshes = 256;
+    for (uint32_t refresh = 0; refresh < refreshes; refresh++){
+        CHECK(render_pending_frame());
+        uint32_t* frame = frame_buffer_swap();
+        CHECK(frame[0] >> 24 <= 1);
+        sum += frame[0] >> 24;
+        // content only advances once every 4 refreshes
+        CHECK(playback_location == files.start[1] + ((refresh / 4 + 1) % 2));
+    }
+    uint16_t expected = gamma_tables[(uint8_t) GammaCurve::GAMMA_2_2].entries[3];
+    CHECK(OutputStage::intermediate[0][0] == expected);
+    int32_t error = (int32_t) (sum << 8) - (int32_t) (refreshes * expected);
+    CHECK(error <= 256 and error >= -256);
+    CHECK(sum > 0);
+
+    // every refresh has to get 250 LEDs out and latch, 6.3 ms, so only 3 of the 4 fit in 20 ms
+    CHECK(frame_refreshes() == 4);
+    light_config.led_count = 250;
+    light_config.fps_ms = 20;
+    CHECK(frame_refreshes() == 3);
+    light_config.fps_ms = 5;
+    CHECK(frame_refreshes() == 1);
+    light_config.dither = (uint8_t) DitherMode::OFF;
+    CHECK(frame_refreshes() == 1);
+}
+
+int main(){
+    test_config_round_trip();
+    test_crc();
+    test_rx_ring();
+    test_frame_queue();
+    test_batch();
+    test_binary_reply();
+    test_stream_upload();
+    test_file_set_and_playback();
+    test_default_file_playback();
+    test_rle_kernel_matches_reference();
+    test_packed_formats();
+    test_delta_format();
+    test_keyframe_format();
+    test_effects();
+    test_external_storage();
+    test_arena();
+    test_file_table();
+    test_flash_store();
+    test_frame_buffer();
+    test_led_sequence();
+    test_parallel_output();
+    test_output_stage();
+    test_temporal_dither();
+
+    if (failures){
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
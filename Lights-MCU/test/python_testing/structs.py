@@ -10,6 +10,7 @@ class ProtoError(Enum):
     PAYLOAD_TOO_LONG  = 0x13
     BAD_VERSION       = 0x14
     BAD_COMMAND       = 0x15 
+    BAD_PAYLOAD_LEN   = 0x16
 
     # Parameter / data issues
     INVALID_PARAM     = 0x20
@@ -32,6 +33,18 @@ class Commands(Enum):
     COLOR_GET = 0x07
     FILE_SET = 0x08
     FILE_GET = 0x09
+    FILE_CLEAR = 0x0A
+    BATCH = 0x0B
+    STREAM_START = 0x0C
+    STREAM_ACK = 0x0D
+    STRIP_SET = 0x0E
+    FILE_FORMAT = 0x0F
+    EFFECT_SET = 0x10
+    FRAME_DURATION = 0x11
+    FILE_STORAGE = 0x12
+    FILE_ALLOC = 0x13
+    FILE_NEW = 0x14
+    FILE_LIST = 0x15
 
 class ConfigIndex(Enum):
     echo = 0x00
@@ -45,4 +58,53 @@ class ConfigIndex(Enum):
     debug_cmd =0x08
     status_report = 0x09
     current_file = 0x0A
-    
\ No newline at end of file
+    binary_reply = 0x0B
+    dma_sequence = 0x0C
+    strip_count = 0x0D
+    brightness = 0x0E
+    channel_gain = 0x0F
+    color_order = 0x10
+    gamma = 0x11
+    dither = 0x12
+    refreshes_per_frame = 0x13
+    
+class ColorOrder(Enum):
+    RGB = 0x00
+    GRB = 0x01
+    BRG = 0x02
+    RBG = 0x03
+    GBR = 0x04
+    BGR = 0x05
+
+class GammaCurve(Enum):
+    LINEAR = 0x00
+    GAMMA_1_8 = 0x01
+    GAMMA_2_0 = 0x02
+    GAMMA_2_2 = 0x03
+    GAMMA_2_5 = 0x04
+    GAMMA_2_8 = 0x05
+
+class DitherMode(Enum):
+    OFF = 0x00
+    ORDERED = 0x01
+    TEMPORAL = 0x02
+
+class FileFormat(Enum):
+    RLE = 0x00
+    RGB565 = 0x01
+    PALETTE8 = 0x02
+    PALETTE4 = 0x03
+    DELTA = 0x04
+    KEYFRAME = 0x05
+
+class StorageKind(Enum):
+    SRAM = 0x00
+    XIP_FLASH = 0x01
+    PSRAM = 0x02
+
+class EffectId(Enum):
+    RAINBOW = 0x00
+    CHASE = 0x01
+    TWINKLE = 0x02
+    FIRE = 0x03
+    BREATHING = 0x04
@@ -1,4 +1,5 @@
 from enum import Enum
+import binascii
 import json
 import serial
 import struct
@@ -21,6 +22,7 @@ logger = logging.getLogger("Light-MCU-Testing")
 PACKET_FORMAT = ">5B2HBB"
 start_packet = 0xAA
 end_packet = 0x55
+stream_start_packet = 0xAB
 version = 0x01
 
 serial_delimiter = b'\n'
@@ -48,15 +50,10 @@ def send_command(ser:serial.Serial, id:CommandValue, data:list[CommandValue|int]
     # sending 32 bit ints, so the length is in bytes
     data_len = len(data)
 
-    packet_format = f'>4B{data_len}I2B'
-    packet = struct.pack(packet_format,
-                         start_packet,
-                         version,
-                         id,
-                         data_len*4, 
-                         *int_data,
-                         0xFF,
-                         end_packet)
+    # CRC-16/CCITT-FALSE over version through the payload, high byte first
+    body = struct.pack(f'>3B{data_len}I', version, id, data_len*4, *int_data)
+    crc = binascii.crc_hqx(body, 0xFFFF)
+    packet = struct.pack('>B', start_packet) + body + struct.pack('>HB', crc, end_packet)
     
 
     # packet_format = PACKET_FORMAT
@@ -155,6 +152,77 @@ def wait_for_response(ser:serial.Serial, value_to_wait_for:int|None = None, inva
             return {"value":value, "error":ProtoError(error)}
     raise ValueError("Did not receive the right data in time")
 
+def send_batch(ser:serial.Serial, commands:list[tuple[CommandValue, list[CommandValue|int]]]):
+    """Send several commands in one BATCH frame, run in order by the firmware.
+    The reply value is a bitmap of which ones failed, error is the first failure."""
+    data:list[CommandValue|int] = []
+    for (id, args) in commands:
+        if isinstance(id, Enum):
+            id = id.value
+        data.append((id << 24) | len(args))
+        data.extend(args)
+    send_command(ser, id=Commands.BATCH, data=data)
+
+def send_stream_chunk(ser:serial.Serial, seq:int, words:list[int]):
+    """One chunk of a streaming upload, only accepted after a STREAM_START.
+    [Stream Start] [Sequence] [Length] [Payload] [CRC] [End]"""
+    body = struct.pack(f'>2H{len(words)}I', seq, len(words)*4, *words)
+    crc = binascii.crc_hqx(body, 0xFFFF)
+    ser.write(struct.pack('>B', stream_start_packet) + body + struct.pack('>HB', crc, end_packet))
+
+def stream_file(ser:serial.Serial, file_id:int, starting_location:int, color_array:list[int], chunk_size:int=256, window:int=4):
+    """Upload a whole file in one go instead of set_color_array_file's 55 colors a frame.
+    The firmware acks every window chunks with the next sequence it wants, so on an error just go back to it."""
+    send_command(ser, id=Commands.STREAM_START, data=[file_id, starting_location, len(color_array), window])
+    response = wait_for_response(ser)
+    if response["error"] != ProtoError.OK:
+        raise ValueError(f"STREAM_START refused {response}")
+
+    chunks = [color_array[i:i+chunk_size] for i in range(0, len(color_array), chunk_size)]
+    seq = 0
+    while seq < len(chunks):
+        window_end = min(seq + window, len(chunks))
+        for chunk_seq in range(seq, window_end):
+            send_stream_chunk(ser, chunk_seq, chunks[chunk_seq])
+        try:
+            response = wait_for_response(ser)
+        except ValueError:
+            logger.getChild("stream_file").info(f"TIMEOUT on ack for {seq=}, asking where to carry on from")
+            send_command(ser, id=Commands.STREAM_ACK, data=[])
+            response = wait_for_response(ser)
+        if response["error"] != ProtoError.OK:
+            logger.getChild("stream_file").error(f"{response} {file_id=} {seq=}")
+        seq = response["value"]
+
+def wait_for_binary_response(ser:serial.Serial, invalid_time_s:float=0.5) -> dict:
+    """Read one binary reply frame, only sent once ConfigIndex.binary_reply is set.
+    [Start] [Version] [Command ID] [Payload Length] [Error] [Value(s)] [CRC] [End]"""
+    starting_time = time.time()
+    crc_len = 2
+
+    while((time.time()-starting_time) < invalid_time_s):
+        start = ser.read(1)
+        if len(start) == 0 or start[0] != start_packet:
+            continue
+        header = ser.read(3)
+        if len(header) != 3:
+            continue
+        (reply_version, command_id, payload_len) = struct.unpack(">3B", header)
+        body = ser.read(payload_len + crc_len + 1)
+        if len(body) != payload_len + crc_len + 1 or body[-1] != end_packet:
+            logger.getChild("wfbr").error(f"bad frame {header.hex(':')=} {body.hex(':')=}")
+            continue
+        crc = binascii.crc_hqx(header + body[:payload_len], 0xFFFF)
+        if struct.unpack(">H", body[payload_len:payload_len + crc_len])[0] != crc:
+            logger.getChild("wfbr").error(f"bad CRC {header.hex(':')=} {body.hex(':')=}")
+            continue
+        error = ProtoError(body[0])
+        values = list(struct.unpack(f">{(payload_len-1)//4}I", body[1:payload_len]))
+        jdata = {"command": command_id, "error": error, "value": values[0] if len(values) == 1 else values}
+        logger.getChild("wfbr").debug(f"returning {jdata}")
+        return jdata
+    raise ValueError("Did not receive the right data in time")
+
 
 def test_setting_up_config(ser:serial.Serial):
     '''